@@ -1,10 +1,21 @@
 #include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
 #ifndef _WIN32
 #include <unistd.h>
+#include <sched.h>
 #include <linux/perf_event.h>
 #include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
 #endif
 using namespace std;
 const int N = 1e8;
@@ -24,36 +35,278 @@ uint64_t rdpmc(uint32_t counter)
 	return ((uint64_t)hi << 32) | lo;
 }
 #ifndef _WIN32
-int perf_fd = -1;
 
 static int perf_event_open(struct perf_event_attr *hw_event, pid_t pid, int cpu, int group_fd, unsigned long flags)
 {
 	return (int)syscall(__NR_perf_event_open, hw_event, pid, cpu, group_fd, flags);
 }
 
-void init_cycle_counter()
+// A perf_event group: the first event is the leader and the rest are opened with its fd as group_fd,
+// so the kernel schedules them onto the PMU together and one read() with PERF_FORMAT_GROUP returns
+// every count from the same instant. If there are more events than counters the group is multiplexed;
+// counts are then scaled by time_enabled / time_running.
+struct PerfEvent
 {
-	struct perf_event_attr attr;
-	memset(&attr, 0, sizeof(attr));
+	string name;
+	uint32_t type;
+	uint64_t config;
+};
 
-	attr.type = PERF_TYPE_HARDWARE;
-	attr.size = sizeof(attr);
-	attr.config = PERF_COUNT_HW_CPU_CYCLES;
-	attr.exclude_kernel = 1;
+struct PerfSample
+{
+	uint64_t enabled, running; // ns the group was enabled and actually counting
+	vector<uint64_t> values;   // one per open event, in PerfGroup::events order
+};
+
+// A generic hardware or software event by its perf name, or rHEX for a raw hardware event
+bool parse_event(const string &name, PerfEvent &e)
+{
+	static const struct
+	{
+		const char *name;
+		uint32_t type;
+		uint64_t config;
+	} known[] = {
+		{"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+		{"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+		{"branches", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS},
+		{"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+		{"cache-references", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES},
+		{"cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+		{"ref-cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_REF_CPU_CYCLES},
+		{"task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+		{"page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+		{"context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+		{"cpu-migrations", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS},
+	};
+	e.name = name;
+	for (auto &k : known)
+		if (name == k.name)
+		{
+			e.type = k.type;
+			e.config = k.config;
+			return true;
+		}
+	char *end;
+	if (name.size() > 1 && name[0] == 'r')
+	{
+		e.type = PERF_TYPE_RAW;
+		e.config = strtoull(name.c_str() + 1, &end, 16);
+		return !*end;
+	}
+	return false;
+}
+
+// Reading a counter from user space: the kernel publishes which hardware counter it gave the event
+// (index, 0 if none right now), the count accumulated before (offset) and the counter width in the
+// event's mmap page, under a sequence lock that changes whenever the event is rescheduled.
+// rdpmc needs cap_user_rdpmc, which Linux grants to a task that has the event mapped
+// (/sys/bus/event_source/devices/cpu/rdpmc = 1, the default). No root, MSR writes or syscalls.
+static inline void compiler_barrier()
+{
+	asm volatile("" ::: "memory");
+}
+
+// The count, and enabled/running extrapolated to now; false if the event is not on a counter
+bool rdpmc_read(const volatile perf_event_mmap_page *pc, uint64_t &count, uint64_t &enabled, uint64_t &running)
+{
+	uint32_t seq;
+	bool ok;
+	do
+	{
+		seq = pc->lock;
+		compiler_barrier();
+		uint32_t idx = pc->index;
+		ok = pc->cap_user_rdpmc && idx;
+		if (ok)
+		{
+			int64_t pmc = rdpmc(idx - 1);
+			int shift = 64 - pc->pmc_width; // the counter is pmc_width bits wide; sign-extend it
+			pmc = (int64_t)((uint64_t)pmc << shift) >> shift;
+			count = pc->offset + pmc;
+		}
+		enabled = pc->time_enabled;
+		running = pc->time_running;
+		if (pc->cap_user_time)
+		{
+			// time since the last update, converted from TSC ticks as the kernel documents in perf_event.h
+			uint64_t cyc = rdtsc(), shift = pc->time_shift, mult = pc->time_mult;
+			uint64_t quot = cyc >> shift, rem = cyc & (((uint64_t)1 << shift) - 1);
+			uint64_t delta = pc->time_offset + quot * mult + ((rem * mult) >> shift);
+			enabled += delta;
+			if (idx)
+				running += delta;
+		}
+		compiler_barrier();
+	} while (pc->lock != seq);
+	return ok;
+}
+
+const size_t MAX_EVENTS = 16; // per group, the size of the read buffers
+
+struct PerfGroup
+{
+	vector<PerfEvent> events;                // the ones that opened
+	vector<int> fds;                         // fds[0] is the leader
+	vector<perf_event_mmap_page *> pages;    // each event's mmap page, NULL where mapping failed
+
+	// Events that cannot be opened, or beyond MAX_EVENTS, are reported and left out; false if none opened
+	bool open(const vector<PerfEvent> &wanted)
+	{
+		for (auto &e : wanted)
+		{
+			if (fds.size() == MAX_EVENTS)
+			{
+				cerr << "at most " << MAX_EVENTS << " events, " << e.name << " left out" << endl;
+				continue;
+			}
+			struct perf_event_attr attr;
+			memset(&attr, 0, sizeof(attr));
+			attr.type = e.type;
+			attr.size = sizeof(attr);
+			attr.config = e.config;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+			attr.disabled = fds.empty(); // the leader starts the whole group
+			int fd = perf_event_open(&attr, 0, -1, fds.empty() ? -1 : fds[0], 0);
+			if (fd == -1)
+			{
+				perror(("perf_event_open " + e.name).c_str());
+				continue;
+			}
+			void *page = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+			events.push_back(e);
+			fds.push_back(fd);
+			pages.push_back(page == MAP_FAILED ? NULL : (perf_event_mmap_page *)page);
+		}
+		if (fds.empty())
+			return false;
+		ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+		return true;
+	}
+
+	// One syscall for every counter: { nr, time_enabled, time_running, value[nr] }
+	bool read(PerfSample &s) const
+	{
+		uint64_t buf[3 + MAX_EVENTS];
+		size_t want = (3 + fds.size()) * sizeof(uint64_t);
+		if (fds.empty() || fds.size() > MAX_EVENTS || ::read(fds[0], buf, want) != (ssize_t)want)
+			return false;
+		s.enabled = buf[1];
+		s.running = buf[2];
+		s.values.assign(buf + 3, buf + 3 + buf[0]);
+		return true;
+	}
 
-	perf_fd = perf_event_open(&attr, 0, -1, -1, 0);
-	if (perf_fd == -1)
+	// Every counter with rdpmc through the mmap pages; false (and s unchanged) unless all of them are
+	// on the PMU and readable from user space, e.g. for software events or with rdpmc disabled
+	bool read_rdpmc(PerfSample &s) const
 	{
-		perror("perf_event_open");
-		exit(1);
+		uint64_t values[MAX_EVENTS], enabled = 0, running = 0;
+		if (fds.empty() || fds.size() > MAX_EVENTS)
+			return false;
+		for (size_t i = 0; i < pages.size(); i++)
+		{
+			uint64_t e, r;
+			if (!pages[i] || !rdpmc_read(pages[i], values[i], e, r))
+				return false;
+			if (i == 0)
+				enabled = e, running = r;
+		}
+		s.enabled = enabled;
+		s.running = running;
+		s.values.assign(values, values + pages.size());
+		return true;
 	}
+
+	// rdpmc if every counter allows it, the group read() otherwise
+	bool read_fast(PerfSample &s) const
+	{
+		return read_rdpmc(s) || read(s);
+	}
+
+	void close()
+	{
+		for (size_t i = 0; i < fds.size(); i++)
+		{
+			if (pages[i])
+				munmap(pages[i], sysconf(_SC_PAGESIZE));
+			::close(fds[i]);
+		}
+		fds.clear();
+		pages.clear();
+		events.clear();
+	}
+};
+
+// Counts between two samples, scaled for multiplexing; fraction receives the share of time counted
+vector<double> perf_delta(const PerfSample &a, const PerfSample &b, double &fraction)
+{
+	uint64_t enabled = b.enabled - a.enabled, running = b.running - a.running;
+	fraction = enabled ? (double)running / enabled : 0;
+	vector<double> d(b.values.size());
+	for (size_t i = 0; i < d.size(); i++)
+		d[i] = running ? (double)(b.values[i] - a.values[i]) * enabled / running : 0;
+	return d;
+}
+
+const char *DEFAULT_EVENTS = "cycles,instructions,branches,branch-misses,cache-references,cache-misses";
+
+// Per-iteration counts, with IPC and miss rates where both events of a ratio were counted
+void print_counts(const PerfGroup &g, const vector<double> &d, double fraction, double per)
+{
+	auto find = [&](const char *name) -> int
+	{
+		for (size_t i = 0; i < g.events.size(); i++)
+			if (g.events[i].name == name)
+				return i;
+		return -1;
+	};
+	int cycles = find("cycles"), branches = find("branches"), refs = find("cache-references");
+	for (size_t i = 0; i < d.size(); i++)
+	{
+		const string &name = g.events[i].name;
+		cout << name << ": " << d[i] / per;
+		if (name == "instructions" && cycles >= 0 && d[cycles] > 0)
+			cout << " (IPC " << d[i] / d[cycles] << ")";
+		else if (name == "branch-misses" && branches >= 0 && d[branches] > 0)
+			cout << " (" << 100 * d[i] / d[branches] << "% of branches)";
+		else if (name == "cache-misses" && refs >= 0 && d[refs] > 0)
+			cout << " (" << 100 * d[i] / d[refs] << "% of cache-references)";
+		cout << endl;
+	}
+	if (fraction < 1)
+		cout << "(multiplexed: counted " << 100 * fraction << "% of the time, scaled)" << endl;
+}
+
+bool parse_events(const string &list, vector<PerfEvent> &events)
+{
+	stringstream in(list);
+	for (string name; getline(in, name, ',');)
+	{
+		PerfEvent e;
+		if (!parse_event(name, e))
+		{
+			cerr << "unknown event " << name << endl;
+			return false;
+		}
+		events.push_back(e);
+	}
+	return true;
 }
 #endif
-int main()
+#ifndef _WIN32
+void run_fixed(const vector<PerfEvent> &events)
+#else
+void run_fixed()
+#endif
 {
-	// system("wrmsr 0xc0010200 0x410076");
 #ifndef _WIN32
-	init_cycle_counter();
+	PerfGroup group;
+	group.open(events);
+	PerfSample start2, end2, start3, end3;
 #endif
 	asm volatile(
 		"pxor %%xmm0, %%xmm0\n\t"
@@ -74,9 +327,8 @@ int main()
 		: "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7", "xmm8", "xmm9", "xmm10", "xmm11", "xmm12");
 	auto start = rdtsc();
 #ifndef _WIN32
-	uint64_t start2;
-	read(perf_fd, &start2, sizeof(start2));
-	auto start3 = rdpmc(0);
+	bool counted = group.read(start2);
+	bool user = group.read_rdpmc(start3);
 #endif
 	for (int i = 0; i < N; i++)
 	{
@@ -98,14 +350,746 @@ int main()
 	}
 	auto end = rdtsc();
 #ifndef _WIN32
-	uint64_t end2;
-	read(perf_fd, &end2, sizeof(end2));
-	auto end3 = rdpmc(0);
+	user = group.read_rdpmc(end3) && user;
+	counted = group.read(end2) && counted;
 #endif
 	cout << "rdtsc: " << 1.0 * (end - start) / N / 11 << endl;
 #ifndef _WIN32
-	cout << "rdpmc: " << 1.0 * (end2 - start2) / N / 11 << endl;
-	cout << "perf_event: " << 1.0 * (end3 - start3) / N / 11 << endl;
+	if (user)
+		cout << "rdpmc " << group.events[0].name << ": " << 1.0 * (end3.values[0] - start3.values[0]) / N / 11 << endl;
+	else if (!group.fds.empty())
+		cout << "rdpmc: not available for these events" << endl;
+	if (!group.fds.empty())
+	{
+		if (counted)
+		{
+			double fraction;
+			vector<double> counts = perf_delta(start2, end2, fraction);
+			print_counts(group, counts, fraction, 1.0 * N * 11);
+		}
+		else
+			cout << "perf: cannot read the counters" << endl;
+	}
+	group.close();
+#endif
+}
+#ifndef _WIN32
+// JIT mode, after nanoBench: the code under test is given as text, unrolled with register rotation,
+// assembled by the system assembler (as + objcopy, as nanoBench does) and run from an executable mapping.
+// The generated function is void f(uint64_t iterations, void *scratch):
+//   callee-saved registers are pushed, r15 = iterations, r14 = scratch (1 MiB, for memory operands),
+//   the init code runs once, then the unrolled body runs in a dec r15 / jnz loop.
+// The code under test must leave r15, r14 and rsp alone.
+const size_t JIT_SCRATCH = 1 << 20;
+
+struct JitSpec
+{
+	string code;                                       // instructions separated by ';' or newlines
+	string init;                                       // run once before the loop
+	int unroll = 1;                                    // copies of code per loop iteration
+	vector<pair<string, vector<string>>> rotations;    // {NAME} in code becomes list[copy % list.size()]
+	bool intel = false;                                // code and init in Intel syntax
+	uint64_t iterations = N / 10;
+};
+
+typedef void (*jit_fn)(uint64_t iterations, void *scratch);
+
+// The unrolled body: copy i has every {NAME} replaced by the i-th register of its rotation
+string jit_body(const JitSpec &spec)
+{
+	string out;
+	for (int i = 0; i < spec.unroll; i++)
+	{
+		string copy = spec.code;
+		for (auto &r : spec.rotations)
+		{
+			string key = "{" + r.first + "}";
+			const string &reg = r.second[i % r.second.size()];
+			for (size_t pos; (pos = copy.find(key)) != string::npos;)
+				copy.replace(pos, key.size(), reg);
+		}
+		out += "\t" + copy + "\n";
+	}
+	return out;
+}
+
+string jit_source(const JitSpec &spec)
+{
+	string user = spec.intel ? "\t.intel_syntax noprefix\n" : "";
+	string back = spec.intel ? "\t.att_syntax prefix\n" : "";
+	return "\t.text\n"
+		   "\tpush %rbx\n\tpush %rbp\n\tpush %r12\n\tpush %r13\n\tpush %r14\n\tpush %r15\n"
+		   "\tmov %rdi, %r15\n\tmov %rsi, %r14\n" +
+		   user + "\t" + spec.init + "\n" + back +
+		   "\t.p2align 6\n1:\n" +
+		   user + jit_body(spec) + back +
+		   "\tdec %r15\n\tjnz 1b\n"
+		   "\tpop %r15\n\tpop %r14\n\tpop %r13\n\tpop %r12\n\tpop %rbp\n\tpop %rbx\n\tret\n";
+}
+
+// Assemble source into flat machine code; the assembler's own messages go to stderr
+bool jit_assemble(const string &source, vector<uint8_t> &code)
+{
+	char dir[] = "/tmp/instbench.XXXXXX";
+	if (!mkdtemp(dir))
+	{
+		perror("mkdtemp");
+		return false;
+	}
+	string base = string(dir) + "/jit";
+	ofstream(base + ".s") << source;
+	string cmd = "as --64 -o " + base + ".o " + base + ".s && objcopy -O binary -j .text " + base + ".o " + base + ".bin";
+	bool ok = system(cmd.c_str()) == 0;
+	if (ok)
+	{
+		ifstream in(base + ".bin", ios::binary);
+		code.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+		ok = !code.empty();
+	}
+	unlink((base + ".s").c_str());
+	unlink((base + ".o").c_str());
+	unlink((base + ".bin").c_str());
+	rmdir(dir);
+	return ok;
+}
+
+// Copy the code into a fresh mapping and make it executable (never writable and executable at once)
+jit_fn jit_load(const vector<uint8_t> &code)
+{
+	void *p = mmap(NULL, code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+	memcpy(p, code.data(), code.size());
+	if (mprotect(p, code.size(), PROT_READ | PROT_EXEC))
+	{
+		munmap(p, code.size());
+		return NULL;
+	}
+	return (jit_fn)p;
+}
+
+// -rot NAME=reg1,reg2,...
+bool parse_rotation(const char *arg, JitSpec &spec)
+{
+	const char *eq = strchr(arg, '=');
+	if (!eq || eq == arg || !eq[1])
+		return false;
+	vector<string> regs;
+	stringstream list(eq + 1);
+	for (string r; getline(list, r, ',');)
+		if (!r.empty())
+			regs.push_back(r);
+	spec.rotations.emplace_back(string(arg, eq), regs);
+	return !regs.empty();
+}
+
+// Cost of one sample of the whole group, in rdtsc ticks
+void print_read_cost(const PerfGroup &g)
+{
+	const int READS = 1000;
+	PerfSample s;
+	uint64_t t0 = rdtsc();
+	for (int i = 0; i < READS; i++)
+		g.read(s);
+	uint64_t t1 = rdtsc();
+	bool user = true;
+	for (int i = 0; i < READS; i++)
+		user = g.read_rdpmc(s) && user;
+	uint64_t t2 = rdtsc();
+	cout << "group read(): " << (t1 - t0) / READS << " ticks";
+	if (user)
+		cout << ", rdpmc: " << (t2 - t1) / READS << " ticks";
+	cout << endl;
+}
+
+// The built-in loop as a JIT spec: sha256rnds2 throughput over 11 independent destinations
+JitSpec builtin_spec()
+{
+	JitSpec spec;
+	spec.code = "sha256rnds2 %xmm2, {D}";
+	for (int i = 0; i <= 12; i++)
+		spec.init += "pxor %xmm" + to_string(i) + ", %xmm" + to_string(i) + "; ";
+	spec.unroll = 11;
+	spec.rotations.emplace_back("D", vector<string>{"%xmm1", "%xmm3", "%xmm4", "%xmm5", "%xmm6", "%xmm7", "%xmm8",
+													 "%xmm9", "%xmm10", "%xmm11", "%xmm12"});
+	return spec;
+}
+
+// Measurement engine: the thread is pinned, each loop is warmed up, and every loop size is sampled
+// reps times, alternating with an empty loop (same prologue, init and dec/jnz, no body). The median
+// of the empty loop at that size is subtracted from each sample, which takes out the loop, call and
+// counter-read overhead; what remains is divided by the copies executed. Reported per counter are
+// min, median and MAD (median absolute deviation) over the repetitions, which unlike mean and
+// standard deviation are not dragged around by the odd interrupted sample.
+struct MeasureOptions
+{
+	int cpu = -1;            // -1 pins to whichever CPU the run starts on
+	int warmup = 3;          // untimed passes of each loop
+	int reps = 11;           // samples per loop size
+	vector<uint64_t> sizes;  // loop iterations; empty for iterations / 100, / 10 and iterations
+	bool user_pmc = false;   // sample with rdpmc where possible
+};
+
+bool pin_cpu(int cpu)
+{
+	if (cpu < 0)
+		cpu = sched_getcpu();
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return cpu >= 0 && sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+// One sample into v: rdtsc ticks, then the group's counts scaled for multiplexing; false if the
+// counters could not be read before or after the run
+bool measure(const PerfGroup &g, jit_fn fn, uint64_t iterations, void *scratch, bool user_pmc, vector<double> &v,
+			 double &fraction)
+{
+	PerfSample a, b;
+	bool counted = user_pmc ? g.read_fast(a) : g.read(a);
+	uint64_t t0 = rdtsc();
+	fn(iterations, scratch);
+	uint64_t t1 = rdtsc();
+	counted = (user_pmc ? g.read_fast(b) : g.read(b)) && counted;
+	fraction = 1;
+	v.assign(1, (double)(t1 - t0));
+	if (g.fds.empty())
+		return true;
+	if (!counted)
+		return false;
+	vector<double> d = perf_delta(a, b, fraction);
+	d.resize(g.fds.size());
+	v.insert(v.end(), d.begin(), d.end());
+	return true;
+}
+
+double median(vector<double> v)
+{
+	sort(v.begin(), v.end());
+	size_t n = v.size();
+	return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+struct Summary
+{
+	double min, median, mad;
+};
+
+Summary summarize(const vector<double> &x)
+{
+	Summary s;
+	s.min = *min_element(x.begin(), x.end());
+	s.median = median(x);
+	vector<double> dev;
+	for (double v : x)
+		dev.push_back(v > s.median ? v - s.median : s.median - v);
+	s.mad = median(dev);
+	return s;
+}
+
+// Assemble and map spec; 0 bytes on failure
+size_t jit_build(const JitSpec &spec, jit_fn &fn)
+{
+	vector<uint8_t> code;
+	if (!jit_assemble(jit_source(spec), code))
+	{
+		cerr << "assembling the generated code failed" << endl;
+		return 0;
+	}
+	fn = jit_load(code);
+	if (!fn)
+	{
+		perror("mmap");
+		return 0;
+	}
+	return code.size();
+}
+
+// The engine's results for one spec
+struct Measurement
+{
+	vector<string> names;            // rdtsc, then the group's events
+	vector<uint64_t> sizes;          // loop iterations sampled
+	vector<vector<Summary>> stats;   // [size][counter], per copy with the baseline subtracted
+	vector<vector<double>> baseline; // [size][counter], the subtracted empty loop per copy
+	double minFraction = 1;          // least share of time counted, under multiplexing
+	size_t codeSize = 0;
+};
+
+vector<uint64_t> default_sizes(const JitSpec &spec, const MeasureOptions &opt)
+{
+	vector<uint64_t> sizes = opt.sizes;
+	if (sizes.empty())
+		for (uint64_t n : {spec.iterations / 100, spec.iterations / 10, spec.iterations})
+			if (n && (sizes.empty() || n != sizes.back()))
+				sizes.push_back(n);
+	return sizes;
+}
+
+// Build spec and its empty loop and sample both; the caller pins and opens the group. A repetition whose
+// counters could not be read is dropped; false if the code did not assemble or no repetition was read.
+bool measure_spec(const JitSpec &spec, const PerfGroup &group, const vector<uint64_t> &sizes, const MeasureOptions &opt,
+				  void *scratch, Measurement &m)
+{
+	JitSpec empty = spec;
+	empty.code.clear();
+	empty.rotations.clear();
+	jit_fn fn, base;
+	size_t size = jit_build(spec, fn), baseSize = size ? jit_build(empty, base) : 0;
+	if (!size || !baseSize)
+	{
+		if (size)
+			munmap((void *)fn, size);
+		return false;
+	}
+	m = Measurement();
+	m.codeSize = size;
+	m.sizes = sizes;
+	m.names.push_back("rdtsc");
+	for (auto &e : group.events)
+		m.names.push_back(e.name);
+
+	for (int i = 0; i < opt.warmup; i++)
+	{
+		fn(sizes[0], scratch);
+		base(sizes[0], scratch);
+	}
+	for (uint64_t n : sizes)
+	{
+		vector<vector<double>> baseSamples(m.names.size()), samples(m.names.size());
+		for (int r = 0; r < opt.reps; r++)
+		{
+			double fb, fk;
+			vector<double> b, k;
+			if (!measure(group, base, n, scratch, opt.user_pmc, b, fb) ||
+				!measure(group, fn, n, scratch, opt.user_pmc, k, fk))
+				continue;
+			m.minFraction = min(m.minFraction, min(fb, fk));
+			for (size_t i = 0; i < m.names.size(); i++)
+			{
+				baseSamples[i].push_back(b[i]);
+				samples[i].push_back(k[i]);
+			}
+		}
+		if (samples[0].empty())
+		{
+			cerr << "perf: cannot read the counters" << endl;
+			munmap((void *)fn, size);
+			munmap((void *)base, baseSize);
+			return false;
+		}
+		double copies = (double)n * spec.unroll;
+		m.stats.emplace_back();
+		m.baseline.emplace_back();
+		for (size_t i = 0; i < m.names.size(); i++)
+		{
+			double overhead = median(baseSamples[i]);
+			for (double &v : samples[i])
+				v = (v - overhead) / copies;
+			m.stats.back().push_back(summarize(samples[i]));
+			m.baseline.back().push_back(overhead / copies);
+		}
+	}
+	munmap((void *)fn, size);
+	munmap((void *)base, baseSize);
+	return true;
+}
+
+int run_jit(const JitSpec &spec, const vector<PerfEvent> &events, const MeasureOptions &opt, bool verbose)
+{
+	if (verbose)
+		cout << jit_source(spec);
+	if (!pin_cpu(opt.cpu))
+		perror("sched_setaffinity");
+	void *scratch = aligned_alloc(4096, JIT_SCRATCH);
+	if (!scratch)
+	{
+		perror("aligned_alloc");
+		return 1;
+	}
+	memset(scratch, 0, JIT_SCRATCH);
+	PerfGroup group;
+	group.open(events);
+
+	Measurement m;
+	bool ok = measure_spec(spec, group, default_sizes(spec, opt), opt, scratch, m);
+	if (ok)
+	{
+		cout << m.codeSize << " bytes of code, " << spec.unroll << " copies per iteration, " << opt.reps
+			 << " repetitions on CPU " << sched_getcpu() << endl;
+		if (opt.user_pmc && !group.fds.empty())
+			print_read_cost(group);
+		cout << left << setw(20) << "counter" << right << setw(12) << "iterations" << setw(12) << "min" << setw(12)
+			 << "median" << setw(12) << "MAD" << setw(12) << "baseline" << endl;
+		cout << fixed << setprecision(4);
+		for (size_t j = 0; j < m.sizes.size(); j++)
+			for (size_t i = 0; i < m.names.size(); i++)
+			{
+				const Summary &s = m.stats[j][i];
+				cout << left << setw(20) << m.names[i] << right << setw(12) << m.sizes[j] << setw(12) << s.min << setw(12)
+					 << s.median << setw(12) << s.mad << setw(12) << m.baseline[j][i] << endl;
+			}
+		if (m.minFraction < 1)
+			cout << "(multiplexed: counted as little as " << 100 * m.minFraction << "% of the time, scaled)" << endl;
+	}
+	group.close();
+	free(scratch);
+	return ok ? 0 : 1;
+}
+
+// Latency and throughput from dependency chains, as uops.info does (Abel and Reineke, ASPLOS 2019).
+// The instruction is a template whose destination operand is {D}; every other {NAME} is a source
+// register, and -implicit names registers it reads without naming them (xmm0 for sha256rnds2).
+//   D -> D         every copy writes the same register, so each copy waits for the previous one if the
+//                  instruction reads D; if it only writes D, renaming makes the copies independent, which
+//                  shows as one register running no slower than all of them, and D is reported as not read
+//   source -> D    D rotates over many registers so the D -> D path is never the bottleneck; a link
+//                  instruction copies each result into the source (or the implicit register) of the
+//                  next copy, and the link's own latency, measured as a chain of itself, is subtracted
+//   throughput     1, 2, ... independent D -> D chains; the time per instruction falls until the
+//                  execution ports saturate, and the first chain count within 5% of the best is reported.
+//                  Without a D -> D dependency every run is already independent and the sweep is skipped.
+struct ChainSpec
+{
+	string code;              // one instruction with {D} and optionally other {NAME} operands
+	string regs = "xmm";      // register class of the operands: gpr, xmm or ymm
+	vector<string> implicit;  // registers read implicitly, kept out of the pool; names without '%'
+	string link;              // copies {from} into {to}; empty for a one-cycle default of the class
+	int maxChains = 0;        // 0 for as many as there are free registers
+};
+
+const int CHAIN_COPIES = 24; // minimum copies per loop iteration, so the loop branch is amortized
+
+// A register name without '%' in the syntax of spec
+string register_name(const string &name, bool intel)
+{
+	return intel ? name : "%" + name;
+}
+
+// The class's registers in the syntax of spec, minus the ones in exclude (names without '%')
+vector<string> register_pool(const string &cls, bool intel, const vector<string> &exclude)
+{
+	vector<string> names;
+	if (cls == "gpr")
+		names = {"rax", "rbx", "rcx", "rdx", "rsi", "rdi", "rbp", "r8", "r9", "r10", "r11", "r12", "r13"};
+	else if (cls == "xmm" || cls == "ymm")
+		for (int i = 0; i < 16; i++)
+			names.push_back(cls + to_string(i));
+	vector<string> pool;
+	for (auto &n : names)
+	{
+		if (find(exclude.begin(), exclude.end(), n) == exclude.end())
+			pool.push_back(register_name(n, intel));
+	}
+	return pool;
+}
+
+string default_link(const string &cls, bool intel)
+{
+	if (cls == "gpr")
+		return intel ? "or {to}, {from}" : "or {from}, {to}";
+	if (cls == "ymm")
+		return intel ? "vpor {to}, {to}, {from}" : "vpor {from}, {to}, {to}";
+	return intel ? "por {to}, {from}" : "por {from}, {to}";
+}
+
+string replace_all(string s, const string &key, const string &with)
+{
+	for (size_t pos = 0; (pos = s.find(key, pos)) != string::npos; pos += with.size())
+		s.replace(pos, key.size(), with);
+	return s;
+}
+
+// The {NAME} operands of code in order of first appearance
+vector<string> template_operands(const string &code)
+{
+	vector<string> ops;
+	for (size_t pos = 0; (pos = code.find('{', pos)) != string::npos;)
+	{
+		size_t end = code.find('}', pos);
+		if (end == string::npos)
+			break;
+		string name = code.substr(pos + 1, end - pos - 1);
+		if (find(ops.begin(), ops.end(), name) == ops.end())
+			ops.push_back(name);
+		pos = end + 1;
+	}
+	return ops;
+}
+
+int run_chains(const ChainSpec &chain, const JitSpec &base, const vector<PerfEvent> &events, const MeasureOptions &opt,
+			   bool verbose)
+{
+	vector<string> ops = template_operands(chain.code);
+	if (find(ops.begin(), ops.end(), "D") == ops.end())
+	{
+		cerr << "the instruction needs a {D} destination operand" << endl;
+		return 2;
+	}
+	vector<string> pool = register_pool(chain.regs, base.intel, chain.implicit);
+	if (pool.empty())
+	{
+		cerr << "unknown register class " << chain.regs << endl;
+		return 2;
+	}
+	// every source but D gets a fixed register, and one more is kept for the source being linked
+	map<string, string> fixedRegs;
+	for (auto &op : ops)
+		if (op != "D" && !pool.empty())
+		{
+			fixedRegs[op] = pool.back();
+			pool.pop_back();
+		}
+	if (pool.size() < 3)
+	{
+		cerr << "not enough " << chain.regs << " registers for the operands" << endl;
+		return 2;
+	}
+	string linkReg = pool.back();
+	pool.pop_back();
+	string link = chain.link.empty() ? default_link(chain.regs, base.intel) : chain.link;
+
+	// a spec running code (which may use {D}) with D rotating over regs, the other sources fixed
+	auto make = [&](string code, const vector<string> &regs) -> JitSpec
+	{
+		JitSpec s = base;
+		for (auto &f : fixedRegs)
+			code = replace_all(code, "{" + f.first + "}", f.second);
+		s.code = code;
+		s.rotations.clear();
+		s.rotations.emplace_back("D", regs);
+		s.unroll = regs.size() * ((CHAIN_COPIES + regs.size() - 1) / regs.size());
+		return s;
+	};
+	if (!pin_cpu(opt.cpu))
+		perror("sched_setaffinity");
+	void *scratch = aligned_alloc(4096, JIT_SCRATCH);
+	if (!scratch)
+	{
+		perror("aligned_alloc");
+		return 1;
+	}
+	memset(scratch, 0, JIT_SCRATCH);
+	PerfGroup group;
+	group.open(events);
+	// one loop size is enough here; it is the smallest of the defaults unless -sizes says otherwise
+	vector<uint64_t> sizes(1, opt.sizes.empty() ? max<uint64_t>(1, base.iterations / 100) : opt.sizes.back());
+	string unit = "ticks";
+	// per-instruction median and MAD of cycles if counted, rdtsc ticks otherwise; false if it did not assemble
+	// or could not be counted
+	auto per_instruction = [&](const JitSpec &s, Summary &out) -> bool
+	{
+		Measurement m;
+		if (verbose)
+			cout << jit_source(s);
+		if (!measure_spec(s, group, sizes, opt, scratch, m))
+			return false;
+		size_t i = 0;
+		for (size_t j = 1; j < m.names.size(); j++)
+			if (m.names[j] == "cycles" && m.stats[0][j].median > 0)
+				i = j;
+		unit = m.names[i] == "cycles" ? "cycles" : "ticks";
+		out = m.stats[0][i];
+		return true;
+	};
+
+	int status = 1; // exit code: 0 once the measurements have all run
+	Summary linkLat, s, many;
+	cout << fixed << setprecision(2);
+	if (per_instruction(make(replace_all(replace_all(link, "{from}", "{D}"), "{to}", "{D}"), {pool[0]}), linkLat) &&
+		per_instruction(make(chain.code, {pool[0]}), s) && per_instruction(make(chain.code, pool), many))
+	{
+		status = 0;
+		// a D that is only written is renamed on every copy, so one register is no slower than all of them
+		bool readsD = s.median > many.median * 1.05;
+		cout << chain.code << ", " << unit << " per instruction, median (MAD) of " << opt.reps << endl;
+		if (readsD)
+			cout << "latency D -> D: " << s.median << " (" << s.mad << ")" << endl;
+		else
+			cout << "latency D -> D: D is not read (" << s.median << " with one register, " << many.median << " with "
+				 << pool.size() << ")" << endl;
+		// each source in turn is fed by the previous copy's result through the link
+		vector<pair<string, string>> sources; // name, register
+		for (auto &op : ops)
+			if (op != "D")
+				sources.emplace_back(op, linkReg);
+		for (auto &r : chain.implicit)
+			sources.emplace_back(r, register_name(r, base.intel));
+		for (auto &src : sources)
+		{
+			string code = chain.code;
+			if (src.first != src.second)
+				code = replace_all(code, "{" + src.first + "}", src.second);
+			code += "; " + replace_all(replace_all(link, "{from}", "{D}"), "{to}", src.second);
+			Summary l;
+			if (!per_instruction(make(code, pool), l))
+			{
+				status = 1;
+				break;
+			}
+			cout << "latency " << src.first << " -> D: " << l.median - linkLat.median << " (" << l.mad << ")"
+				 << " = " << l.median << " - link " << linkLat.median << endl;
+		}
+
+		size_t maxChains = chain.maxChains > 0 ? min((size_t)chain.maxChains, pool.size()) : pool.size();
+		vector<double> perChains;
+		if (readsD && !status)
+			cout << setw(8) << "chains" << setw(12) << unit << setw(12) << "MAD" << endl;
+		for (size_t c = 1; c <= maxChains && readsD && !status; c++)
+		{
+			Summary t;
+			if (!per_instruction(make(chain.code, vector<string>(pool.begin(), pool.begin() + c)), t))
+				status = 1;
+			else
+			{
+				perChains.push_back(t.median);
+				cout << setw(8) << c << setw(12) << t.median << setw(12) << t.mad << endl;
+			}
+		}
+		if (!readsD && !status)
+			cout << "throughput: " << many.median << " " << unit << " per instruction (" << 1 / many.median << " per "
+				 << unit.substr(0, unit.size() - 1) << "), copies independent" << endl;
+		else if (!status)
+		{
+			double best = *min_element(perChains.begin(), perChains.end());
+			size_t saturated = 0;
+			while (perChains[saturated] > best * 1.05)
+				saturated++;
+			cout << "throughput: " << best << " " << unit << " per instruction (" << 1 / best << " per "
+				 << unit.substr(0, unit.size() - 1) << "), saturated from " << saturated + 1 << " chains" << endl;
+		}
+	}
+	group.close();
+	free(scratch);
+	return status;
+}
+#endif
+
+static void usage(const char *prog)
+{
+#ifdef _WIN32
+	cout << "Usage: " << prog << "      the built-in sha256rnds2 throughput loop, run once" << endl;
+#else
+	cout << "Usage: " << prog << " -fixed [-e events]      the built-in sha256rnds2 throughput loop, run once" << endl;
+	cout << "       " << prog << " [-asm code [-init code] [-unroll k] [-rot NAME=reg,...]... [-intel]] [-n iterations]" << endl;
+	cout << "       " << prog << "     [-sizes n,n,...] [-reps k] [-warmup w] [-cpu c] [-rdpmc] [-v] [-e events]" << endl;
+	cout << "  Without -asm the built-in loop is measured. The thread is pinned to CPU c (default: the current one)," << endl;
+	cout << "  each loop is run w times (default 3) untimed, then k times (default 11) for each loop size (default" << endl;
+	cout << "  iterations / 100, / 10 and iterations), alternating with an empty loop whose median is subtracted." << endl;
+	cout << "  Each counter is reported per copy of code as min, median and MAD over the repetitions, with the" << endl;
+	cout << "  subtracted baseline." << endl;
+	cout << "       " << prog << " -chains code [-regs gpr|xmm|ymm] [-implicit reg]... [-link code] [-max c] [-init code]" << endl;
+	cout << "       " << prog << "     [-intel] [-n iterations] [-sizes n] [-reps k] [-warmup w] [-cpu c] [-rdpmc] [-v] [-e events]" << endl;
+	cout << "  Latency and throughput of one instruction: code names its destination {D} and other register" << endl;
+	cout << "  operands {NAME}; -implicit lists registers it reads without naming them. Reports the latency from" << endl;
+	cout << "  D and from each source to D, using -link (default a one-cycle or of {from} into {to}) to feed a" << endl;
+	cout << "  result into a source, and the time per instruction over 1 to c independent chains (default: as many" << endl;
+	cout << "  as registers allow), with the point where it stops improving. Runs iterations / 100 (default 100000)" << endl;
+	cout << "  loop iterations of at least " << CHAIN_COPIES << " copies, or the largest of -sizes." << endl;
+	cout << "  code is assembler text, instructions separated by ';'; {NAME} in it takes the next register of" << endl;
+	cout << "  rotation NAME in each unrolled copy. r14 points to 1 MiB of scratch memory; r14, r15 and rsp are reserved." << endl;
+	cout << "  -rdpmc samples the counters with rdpmc through the perf mmap pages instead of read() where every event" << endl;
+	cout << "  is on a hardware counter, and prints the cost of both; -v prints the generated assembly." << endl;
+	cout << "  events is a comma-separated list of cycles, instructions, branches, branch-misses, cache-references," << endl;
+	cout << "  cache-misses, ref-cycles, task-clock, page-faults, context-switches, cpu-migrations and rHEX raw events," << endl;
+	cout << "  counted as one group (default " << DEFAULT_EVENTS << ")." << endl;
 #endif
-	return 0;
-}
\ No newline at end of file
+}
+
+int main(int argc, char *argv[])
+{
+#ifdef _WIN32
+	if (argc == 1)
+	{
+		run_fixed();
+		return 0;
+	}
+	usage(argv[0]);
+	return 2;
+#else
+	JitSpec spec;
+	MeasureOptions opt;
+	ChainSpec chain;
+	vector<PerfEvent> events;
+	string eventList = DEFAULT_EVENTS;
+	bool verbose = false, once = false;
+	for (int i = 1; i < argc; i++)
+	{
+		string a = argv[i];
+		bool more = i + 1 < argc;
+		if (a == "-asm" && more)
+			spec.code = argv[++i];
+		else if (a == "-init" && more)
+			spec.init = argv[++i];
+		else if (a == "-unroll" && more)
+			spec.unroll = max(1, atoi(argv[++i]));
+		else if (a == "-rot" && more)
+		{
+			if (!parse_rotation(argv[++i], spec))
+			{
+				cerr << "bad rotation " << argv[i] << ", expected NAME=reg,reg,..." << endl;
+				return 2;
+			}
+		}
+		else if (a == "-n" && more)
+			spec.iterations = max(1ll, atoll(argv[++i]));
+		else if (a == "-intel")
+			spec.intel = true;
+		else if (a == "-sizes" && more)
+		{
+			stringstream list(argv[++i]);
+			for (string n; getline(list, n, ',');)
+				if (atoll(n.c_str()) > 0)
+					opt.sizes.push_back(atoll(n.c_str()));
+		}
+		else if (a == "-reps" && more)
+			opt.reps = max(1, atoi(argv[++i]));
+		else if (a == "-warmup" && more)
+			opt.warmup = max(0, atoi(argv[++i]));
+		else if (a == "-cpu" && more)
+			opt.cpu = atoi(argv[++i]);
+		else if (a == "-chains" && more)
+			chain.code = argv[++i];
+		else if (a == "-regs" && more)
+			chain.regs = argv[++i];
+		else if (a == "-implicit" && more)
+		{
+			string r = argv[++i];
+			chain.implicit.push_back(r[0] == '%' ? r.substr(1) : r);
+		}
+		else if (a == "-link" && more)
+			chain.link = argv[++i];
+		else if (a == "-max" && more)
+			chain.maxChains = atoi(argv[++i]);
+		else if (a == "-fixed")
+			once = true;
+		else if (a == "-rdpmc")
+			opt.user_pmc = true;
+		else if (a == "-v")
+			verbose = true;
+		else if (a == "-e" && more)
+			eventList = argv[++i];
+		else
+		{
+			usage(argv[0]);
+			return 2;
+		}
+	}
+	if (!parse_events(eventList, events))
+		return 2;
+	if (once)
+	{
+		run_fixed(events);
+		return 0;
+	}
+	if (!chain.code.empty())
+		return run_chains(chain, spec, events, opt, verbose);
+	if (spec.code.empty())
+	{
+		uint64_t iterations = spec.iterations;
+		spec = builtin_spec();
+		spec.iterations = iterations;
+	}
+	return run_jit(spec, events, opt, verbose);
+#endif
+}
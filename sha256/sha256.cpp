@@ -1,221 +1,463 @@
 #include <iostream>
-#include <fstream>
+#include <cctype>
 #include <cstdint>
 #include <chrono>
+#include <algorithm>
+#include <vector>
+#include <thread>
+#include <x86intrin.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+#include "sha256.h"
+#include "sha256_fixed.h"
+#include "sha512.h"
 using namespace std;
-const int BLOCK_SIZE = 64;
-const int DIGEST_SIZE = 32;
-const uint32_t K256[64] = {
-	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
-	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
-	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
-	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
-	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
-	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
-	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
-	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
-	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
-	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
-	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
-	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
-	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
-	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
-	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
-	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
-#define ROTR(x, n) ((x >> n) | (x << (32 - n)))
-extern "C" void sha256_ni_transform(uint32_t *digest, const void *data, uint32_t numBlocks);
-struct SHA256
+
+// Every lane compresses the same block n / lanes times; returns the time taken
+double benchmark_mb(mb_kernel kernel, int lanes, int n, uint8_t *data)
 {
-	uint32_t state[8];
-	uint8_t buffer[BLOCK_SIZE];
-	uint64_t totalBytes;
+	uint32_t state[8 * MB_LANES_AVX512];
+	const uint8_t *ptr[MB_LANES_AVX512];
+	uint64_t nblocks[MB_LANES_AVX512];
+	for (int l = 0; l < lanes; l++)
+	{
+		for (int j = 0; j < 8; j++)
+			state[j * lanes + l] = H256[j];
+		ptr[l] = data;
+		nblocks[l] = 1;
+	}
+	int steps = n / lanes;
+	auto start = chrono::high_resolution_clock::now();
+	for (int i = 0; i < steps; i++)
+		kernel(state, ptr, nblocks, 1);
+	auto end = chrono::high_resolution_clock::now();
+	return chrono::duration_cast<chrono::duration<double>>(end - start).count();
+}
 
-	SHA256()
+// Hash count independent 1 KiB messages with SHA-NI (one after another and two interleaved) and with AVX-512 (16 lanes)
+// to find how many independent inputs the wide multi-buffer path needs to win.
+void crossover(int n)
+{
+	const int MSG_BLOCKS = 16, MAX_COUNT = 256;
+	static uint8_t msg[MAX_COUNT][MSG_BLOCKS * BLOCK_SIZE];
+	const uint8_t *msgs[MAX_COUNT];
+	uint64_t lens[MAX_COUNT];
+	static uint32_t digests[MAX_COUNT][8];
+	for (int i = 0; i < MAX_COUNT; i++)
 	{
-		totalBytes = 0;
-		state[0] = 0x6a09e667;
-		state[1] = 0xbb67ae85;
-		state[2] = 0x3c6ef372;
-		state[3] = 0xa54ff53a;
-		state[4] = 0x510e527f;
-		state[5] = 0x9b05688c;
-		state[6] = 0x1f83d9ab;
-		state[7] = 0x5be0cd19;
+		for (int j = 0; j < MSG_BLOCKS * BLOCK_SIZE; j++)
+			msg[i][j] = i + j;
+		msgs[i] = msg[i];
+		lens[i] = MSG_BLOCKS * BLOCK_SIZE;
 	}
+	// the padding block of a message of exactly MSG_BLOCKS blocks
+	uint8_t pad[BLOCK_SIZE] = {0x80};
+	uint64_t bitLen = MSG_BLOCKS * BLOCK_SIZE * 8;
+	for (int i = 0; i < 8; i++)
+		pad[56 + i] = (bitLen >> ((7 - i) * 8)) & 0xFF;
 
-	void processBlock(uint8_t *block)
+	cout << "count\tsha_ni msgs/s\tsha_ni_x2 msgs/s\tavx512_x16 msgs/s" << endl;
+	for (int count = 1; count <= MAX_COUNT; count *= 2)
 	{
-		uint32_t w[64];
-		for (int i = 0; i < 16; i++)
-		{
-			w[i] = (block[i * 4 + 0] << 24) | (block[i * 4 + 1] << 16) | (block[i * 4 + 2] << 8) | (block[i * 4 + 3] << 0);
-		}
-		for (int i = 16; i < 64; i++)
-		{
-			uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
-			uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
-			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
-		}
-		uint32_t a = state[0];
-		uint32_t b = state[1];
-		uint32_t c = state[2];
-		uint32_t d = state[3];
-		uint32_t e = state[4];
-		uint32_t f = state[5];
-		uint32_t g = state[6];
-		uint32_t h = state[7];
-		for (int i = 0; i < 64; i++)
+		int reps = max(1, n / (MSG_BLOCKS + 1) / count);
+		auto start = chrono::high_resolution_clock::now();
+		for (int r = 0; r < reps; r++)
+			for (int i = 0; i < count; i++)
+			{
+				SHA256 sha256;
+				sha256_ni_blocks(sha256.state, msgs[i], MSG_BLOCKS);
+				sha256_ni_blocks(sha256.state, pad, 1);
+				digests[i][0] = sha256.state[0];
+			}
+		auto end = chrono::high_resolution_clock::now();
+		double time1 = chrono::duration_cast<chrono::duration<double>>(end - start).count();
+		start = chrono::high_resolution_clock::now();
+		for (int r = 0; r < reps; r++)
+			sha256_mb_sha_ni(msgs, lens, digests, count);
+		end = chrono::high_resolution_clock::now();
+		double time3 = chrono::duration_cast<chrono::duration<double>>(end - start).count();
+		start = chrono::high_resolution_clock::now();
+		for (int r = 0; r < reps; r++)
+			sha256_mb_avx512(msgs, lens, digests, count);
+		end = chrono::high_resolution_clock::now();
+		double time2 = chrono::duration_cast<chrono::duration<double>>(end - start).count();
+		cout << count << "\t" << reps * count / time1 << "\t" << reps * count / time3 << "\t" << reps * count / time2 << endl;
+	}
+}
+
+// Merkle root over n / 2 32-byte leaf hashes: the streaming SHA256 per node against the batch builder
+void benchmark_merkle(int n)
+{
+	size_t count = max(2, n / 2);
+	vector<uint8_t> level(count * DIGEST_SIZE);
+	for (size_t i = 0; i < level.size(); i++)
+		level[i] = i * 7;
+	vector<uint8_t> a(level);
+	auto start = chrono::high_resolution_clock::now();
+	for (size_t c = count; c > 1;)
+	{
+		size_t pairs = c / 2;
+		for (size_t i = 0; i < pairs; i++)
 		{
-			uint32_t S1 = ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25);
-			uint32_t ch = (e & f) ^ ((~e) & g);
-			uint32_t temp1 = h + S1 + ch + K256[i] + w[i];
-			uint32_t S0 = ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22);
-			uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
-			uint32_t temp2 = S0 + maj;
-			h = g;
-			g = f;
-			f = e;
-			e = d + temp1;
-			d = c;
-			c = b;
-			b = a;
-			a = temp1 + temp2;
+			SHA256 sha256;
+			sha256.update(&MERKLE_NODE, 1);
+			sha256.update(&a[i * 2 * DIGEST_SIZE], 2 * DIGEST_SIZE);
+			sha256.final();
+			digest_bytes(sha256.state, &a[i * DIGEST_SIZE]);
 		}
-		state[0] += a;
-		state[1] += b;
-		state[2] += c;
-		state[3] += d;
-		state[4] += e;
-		state[5] += f;
-		state[6] += g;
-		state[7] += h;
-		totalBytes += BLOCK_SIZE;
+		if (c % 2)
+			memmove(&a[pairs * DIGEST_SIZE], &a[(c - 1) * DIGEST_SIZE], DIGEST_SIZE);
+		c = pairs + c % 2;
 	}
+	auto end = chrono::high_resolution_clock::now();
+	double time1 = chrono::duration_cast<chrono::duration<double>>(end - start).count();
+
+	uint8_t root[DIGEST_SIZE];
+	start = chrono::high_resolution_clock::now();
+	merkle_root32(level.data(), count, root);
+	end = chrono::high_resolution_clock::now();
+	double time2 = chrono::duration_cast<chrono::duration<double>>(end - start).count();
+	if (memcmp(root, a.data(), DIGEST_SIZE))
+		cout << "merkle: root mismatch" << endl;
+	cout << "merkle update(): " << (count - 1) / time1 << " nodes/s" << endl;
+	cout << "merkle batch: " << (count - 1) / time2 << " nodes/s" << endl;
+}
 
-	void processBlock_asm(uint8_t *block)
+// Short fixed-length messages: SHA256::sha256() against sha256_fixed<N>
+template <int N>
+void benchmark_fixed(int n)
+{
+	uint8_t msg[N];
+	for (int i = 0; i < N; i++)
+		msg[i] = i;
+	SHA256 sha256;
+	auto start = chrono::high_resolution_clock::now();
+	for (int i = 0; i < n; i++)
 	{
-#ifdef _WIN32
-		// convert to AMD64 ABI under Windows
-		// backup rdi, rsi, rdx, rax and xmms for safety
-		asm volatile(
-			"pushq %%rdi\n\t"
-			"pushq %%rsi\n\t"
-			"pushq %%rdx\n\t"
-			"pushq %%rax\n\t"
-			"subq $0x40, %%rsp\n\t"
-			"movdqu %%xmm6, (%%rsp)\n\t"
-			"movdqu %%xmm7, 0x10(%%rsp)\n\t"
-			"movdqu %%xmm8, 0x20(%%rsp)\n\t"
-			"movdqu %%xmm9, 0x30(%%rsp)\n\t"
-			:
-			:
-			: "memory");
-		asm volatile(
-			"mov %0, %%rdi\n\t"
-			"mov %1, %%rsi\n\t"
-			"mov $1, %%rdx\n\t"
-			"call sha256_ni_transform\n\t"
-			:
-			: "r"(state), "r"(block)
-			: "rdi", "rsi", "rdx");
-		// restore registers
-		asm volatile(
-			"movdqu (%%rsp), %%xmm6\n\t"
-			"movdqu 0x10(%%rsp), %%xmm7\n\t"
-			"movdqu 0x20(%%rsp), %%xmm8\n\t"
-			"movdqu 0x30(%%rsp), %%xmm9\n\t"
-			"addq $0x40, %%rsp\n\t"
-			"popq %%rax\n\t"
-			"popq %%rdx\n\t"
-			"popq %%rsi\n\t"
-			"popq %%rdi\n\t"
-			:
-			:
-			: "memory");
-#else
-		sha256_ni_transform(state, block, 1);
-#endif
+		sha256 = SHA256();
+		sha256.sha256(msg, N);
+		msg[0] = sha256.state[0];
+	}
+	auto end = chrono::high_resolution_clock::now();
+	double time1 = chrono::duration_cast<chrono::duration<double>>(end - start).count();
+	msg[0] = 0;
+	uint32_t digest[8];
+	start = chrono::high_resolution_clock::now();
+	for (int i = 0; i < n; i++)
+	{
+		sha256_fixed<N>(msg, digest);
+		msg[0] = digest[0];
 	}
+	end = chrono::high_resolution_clock::now();
+	double time2 = chrono::duration_cast<chrono::duration<double>>(end - start).count();
+	if (memcmp(digest, sha256.state, sizeof(digest)))
+		cout << "fixed<" << N << ">: digest mismatch" << endl;
+	cout << N << " bytes sha256(): " << n / time1 << " msgs/s" << endl;
+	cout << N << " bytes fixed<" << N << ">: " << n / time2 << " msgs/s" << endl;
+}
 
-	void sha256(uint8_t *data, uint64_t len)
+// Double SHA-256 nonce search per backend: n nonces against an unreachable target, on one thread and on every core.
+// An easy target first checks that every backend finds the same lowest nonce as the reference.
+void benchmark_sha256d(int n)
+{
+	uint8_t header[POW_HEADER_SIZE], easy[DIGEST_SIZE], none[DIGEST_SIZE] = {0};
+	for (int i = 0; i < POW_HEADER_SIZE; i++)
+		header[i] = i * 13;
+	memset(easy, 0xFF, DIGEST_SIZE);
+	easy[DIGEST_SIZE - 1] = 0; // about one nonce in 256
+	int cores = thread::hardware_concurrency();
+	const char *backends[] = {"generic", "sha_ni", "avx2", "avx512"};
+	for (const char *b : backends)
 	{
-		uint64_t i = 0;
-		while (len - i >= BLOCK_SIZE)
-		{
-			processBlock(data + i);
-			i += BLOCK_SIZE;
-		}
-		uint8_t block[BLOCK_SIZE] = {0};
-		uint64_t rem = len - i;
-		for (uint64_t j = 0; j < rem; j++)
-		{
-			block[j] = data[i + j];
-		}
-		block[rem] = 0x80;
-		uint64_t bitLen = len * 8;
-		if (rem < 56)
+		if (!sha256d_supported(b))
+			continue;
+		NonceResult r;
+		uint8_t ref[DIGEST_SIZE];
+		sha256d_search(header, easy, 0, 1 << 20, 1, b, r);
+		memcpy(header + POW_NONCE_OFFSET, &r.nonce, 4);
+		sha256d(header, ref);
+		if (!r.found || memcmp(ref, r.hash, DIGEST_SIZE) || r.hashes != (uint64_t)r.nonce + 1)
+			cout << "sha256d " << b << ": wrong nonce" << endl;
+
+		auto start = chrono::high_resolution_clock::now();
+		sha256d_search(header, none, 0, n, 1, b, r);
+		auto end = chrono::high_resolution_clock::now();
+		double time1 = chrono::duration_cast<chrono::duration<double>>(end - start).count();
+		start = chrono::high_resolution_clock::now();
+		sha256d_search(header, none, 0, (uint64_t)n * cores, 0, b, r);
+		end = chrono::high_resolution_clock::now();
+		double time2 = chrono::duration_cast<chrono::duration<double>>(end - start).count();
+		cout << "sha256d " << b << ": " << n / time1 << " hashes/s on 1 thread, " << r.hashes / time2 << " hashes/s on "
+			 << cores << " (" << r.hashes / time2 / cores << " per core)" << endl;
+	}
+}
+
+// PBKDF2 iterations/s: HMAC recomputing both pad blocks every iteration, the cached pad states
+// one password at a time, and 16 passwords filling the lanes together
+void benchmark_pbkdf2(int n)
+{
+	const int PASSWORDS = 16;
+	uint64_t iterations = max(1, n / 100);
+	uint8_t password[PASSWORDS][8], salt[16], out[PASSWORDS][DIGEST_SIZE], ref[DIGEST_SIZE];
+	for (int i = 0; i < PASSWORDS; i++)
+		memcpy(password[i], "password", 8), password[i][7] = 'a' + i;
+	memset(salt, 's', sizeof(salt));
+
+	auto start = chrono::high_resolution_clock::now();
+	uint8_t k[BLOCK_SIZE] = {0}, pad[BLOCK_SIZE], u[DIGEST_SIZE + 4] = {0};
+	memcpy(k, password[0], 8);
+	memcpy(u, salt, sizeof(salt));
+	u[sizeof(salt) + 3] = 1;
+	for (uint64_t it = 0; it < iterations; it++)
+	{
+		SHA256 inner, outer;
+		for (int i = 0; i < BLOCK_SIZE; i++)
+			pad[i] = k[i] ^ 0x36;
+		inner.update(pad, BLOCK_SIZE);
+		inner.update(u, it ? DIGEST_SIZE : sizeof(salt) + 4);
+		inner.final();
+		for (int i = 0; i < BLOCK_SIZE; i++)
+			pad[i] = k[i] ^ 0x5c;
+		outer.update(pad, BLOCK_SIZE);
+		digest_bytes(inner.state, u);
+		outer.update(u, DIGEST_SIZE);
+		outer.final();
+		digest_bytes(outer.state, u);
+		for (int i = 0; i < DIGEST_SIZE; i++)
+			ref[i] = it ? ref[i] ^ u[i] : u[i];
+	}
+	auto end = chrono::high_resolution_clock::now();
+	double time1 = chrono::duration_cast<chrono::duration<double>>(end - start).count();
+
+	start = chrono::high_resolution_clock::now();
+	pbkdf2_hmac_sha256(password[0], 8, salt, sizeof(salt), iterations, out[0], DIGEST_SIZE);
+	end = chrono::high_resolution_clock::now();
+	double time2 = chrono::duration_cast<chrono::duration<double>>(end - start).count();
+	if (memcmp(out[0], ref, DIGEST_SIZE))
+		cout << "pbkdf2: mismatch" << endl;
+
+	PBKDF2Job jobs[PASSWORDS];
+	for (int i = 0; i < PASSWORDS; i++)
+		jobs[i] = {password[i], 8, salt, sizeof(salt), out[i], DIGEST_SIZE};
+	start = chrono::high_resolution_clock::now();
+	pbkdf2_hmac_sha256_batch(jobs, PASSWORDS, iterations);
+	end = chrono::high_resolution_clock::now();
+	double time3 = chrono::duration_cast<chrono::duration<double>>(end - start).count();
+	if (memcmp(out[0], ref, DIGEST_SIZE))
+		cout << "pbkdf2 batch: mismatch" << endl;
+	cout << "pbkdf2 hmac per iteration: " << iterations / time1 << " iterations/s" << endl;
+	cout << "pbkdf2 cached pads: " << iterations / time2 << " iterations/s" << endl;
+	cout << "pbkdf2 batch of " << PASSWORDS << ": " << iterations * PASSWORDS / time3 << " iterations/s" << endl;
+}
+
+// One SHA-NI stream against 2 interleaved ones: rdtsc ticks and core cycles per block
+void benchmark_ni_interleave(int n)
+{
+	const int BLOCKS = 16;
+	static uint8_t buf[NI_LANES_X2][BLOCKS * BLOCK_SIZE];
+	const uint8_t *ptr[NI_LANES_X2];
+	uint64_t nblocks[NI_LANES_X2];
+	uint32_t state[8 * NI_LANES_X2];
+	for (int l = 0; l < NI_LANES_X2; l++)
+	{
+		for (int i = 0; i < BLOCKS * BLOCK_SIZE; i++)
+			buf[l][i] = i + l;
+		ptr[l] = buf[l];
+		nblocks[l] = BLOCKS;
+		for (int j = 0; j < 8; j++)
+			state[j * NI_LANES_X2 + l] = H256[j];
+	}
+	int fd = open_cycle_counter();
+	const int lanes[] = {1, NI_LANES_X2};
+	const mb_kernel kernels[] = {NULL, sha256_ni_x2};
+	for (int k = 0; k < 2; k++)
+	{
+		int steps = max(1, n / BLOCKS / lanes[k]);
+		uint64_t c0 = read_cycles(fd), t0 = __rdtsc();
+		for (int i = 0; i < steps; i++)
 		{
-			for (int i = 0; i < 8; i++)
-			{
-				block[56 + i] = (bitLen >> ((7 - i) * 8)) & 0xFF;
-			}
-			processBlock(block);
+			if (kernels[k])
+				kernels[k](state, ptr, nblocks, BLOCKS);
+			else
+				sha256_ni_blocks(state, buf[0], BLOCKS);
 		}
-		else
+		uint64_t t1 = __rdtsc(), c1 = read_cycles(fd);
+		double blocks = (double)steps * BLOCKS * lanes[k];
+		cout << "sha_ni x" << lanes[k] << ": " << (t1 - t0) / blocks << " ticks/block";
+		if (fd >= 0)
+			cout << ", " << (c1 - c0) / blocks << " cycles/block";
+		cout << endl;
+	}
+	if (fd >= 0)
+		close(fd);
+}
+
+// The same bytes through SHA-256 and each SHA-512 backend, in MB/s so the digests compare per byte
+void benchmark_sha512(int n)
+{
+	const int CHUNK = 1 << 20;
+	static uint8_t data[CHUNK];
+	for (int i = 0; i < CHUNK; i++)
+		data[i] = i;
+	uint64_t bytes = max<uint64_t>(CHUNK, (uint64_t)n * BLOCK_SIZE / CHUNK * CHUNK);
+
+	SHA256 sha256;
+	auto start = chrono::high_resolution_clock::now();
+	for (uint64_t done = 0; done < bytes; done += CHUNK)
+		sha256.update(data, CHUNK);
+	auto end = chrono::high_resolution_clock::now();
+	double time = chrono::duration_cast<chrono::duration<double>>(end - start).count();
+	cout << "sha256 (" << sha256_transform_name << "): " << bytes / time / 1e6 << " MB/s" << endl;
+
+	const char *names[] = {"generic", "avx2"};
+	const sha512_transform_fn fns[] = {sha512_generic_transform, sha512_avx2_transform};
+	uint64_t ref[8];
+	for (int k = 0; k < 2; k++)
+	{
+		if (k && !CheckForAVX2())
+			break;
+		uint64_t state[8];
+		memcpy(state, H512, sizeof(state));
+		start = chrono::high_resolution_clock::now();
+		for (uint64_t done = 0; done < bytes; done += CHUNK)
+			fns[k](state, data, CHUNK / SHA512_BLOCK_SIZE);
+		end = chrono::high_resolution_clock::now();
+		time = chrono::duration_cast<chrono::duration<double>>(end - start).count();
+		if (k && memcmp(state, ref, sizeof(ref)))
+			cout << "sha512 " << names[k] << ": mismatch" << endl;
+		memcpy(ref, state, sizeof(ref));
+		cout << "sha512 " << names[k] << ": " << bytes / time / 1e6 << " MB/s" << endl;
+	}
+
+	if (!CheckForAVX2())
+		return;
+	// 4 KiB messages, as many as cover the same bytes
+	const int MSG = 4096, COUNT = CHUNK / MSG;
+	const uint8_t *msgs[COUNT];
+	uint64_t lens[COUNT];
+	static uint64_t digests[COUNT][8];
+	for (int i = 0; i < COUNT; i++)
+	{
+		msgs[i] = data + i * MSG;
+		lens[i] = MSG;
+	}
+	const char *mbNames[] = {"serial", "avx2_x4"};
+	const sha512_mb_fn mbFns[] = {sha512_mb_serial, sha512_mb_avx2};
+	for (int k = 0; k < 2; k++)
+	{
+		start = chrono::high_resolution_clock::now();
+		for (uint64_t done = 0; done < bytes; done += CHUNK)
+			mbFns[k](H512, msgs, lens, digests, COUNT);
+		end = chrono::high_resolution_clock::now();
+		time = chrono::duration_cast<chrono::duration<double>>(end - start).count();
+		cout << "sha512 mb " << mbNames[k] << ": " << bytes / time / 1e6 << " MB/s" << endl;
+	}
+
+	// SHA-512 and, from its own IV, SHA-384 against the streaming struct; odd lengths exercise the padding
+	for (int i = 0; i < COUNT; i++)
+		lens[i] = i * 37 % MSG;
+	const int sizes[] = {SHA512_DIGEST_SIZE, SHA384_DIGEST_SIZE};
+	for (int size : sizes)
+	{
+		sha512_mb_avx2(size == SHA384_DIGEST_SIZE ? H384 : H512, msgs, lens, digests, COUNT);
+		for (int i = 0; i < COUNT; i++)
 		{
-			processBlock(block);
-			for (int i = 0; i < 56; i++)
-			{
-				block[i] = 0;
-			}
-			for (int i = 0; i < 8; i++)
+			SHA512 ref(size);
+			ref.update(msgs[i], lens[i]);
+			ref.final();
+			if (memcmp(ref.state, digests[i], sizeof(ref.state)))
 			{
-				block[56 + i] = (bitLen >> ((7 - i) * 8)) & 0xFF;
+				cout << "sha" << size * 8 << " mb avx2_x4: mismatch" << endl;
+				break;
 			}
-			processBlock(block);
 		}
 	}
-};
+}
 
-/*
-void readfile(char *filename)
+// The vectorized-schedule single-stream backends over n / 16 runs of 16 consecutive blocks
+void benchmark_simd(int n, const uint32_t ref[8])
 {
-	ifstream fin(filename, ios::binary);
-	SHA256 sha256;
-	fin.seekg(0, ios::end);
-	uint64_t len = fin.tellg();
-	fin.seekg(0, ios::beg);
-	uint8_t *data = new uint8_t[len];
-	fin.read((char *)data, len);
-	sha256.sha256(data, len);
-	cout << hex;
-	cout.width(8);
-	cout.fill('0');
-	for (int i = 0; i < 8; i++)
-		cout << sha256.state[i];
-	cout << endl;
+	const int BLOCKS = 16;
+	static uint8_t data[BLOCKS * BLOCK_SIZE];
+	for (int i = 0; i < BLOCKS * BLOCK_SIZE; i++)
+		data[i] = i % BLOCK_SIZE;
+	const char *names[] = {"ssse3", "avx", "avx2"};
+	const sha256_transform_fn fns[] = {sha256_ssse3_transform, sha256_avx_transform, sha256_avx2_transform};
+	const bool supported[] = {cpu_features.ssse3, cpu_features.avx, cpu_features.avx2};
+	for (int k = 0; k < 3; k++)
+	{
+		if (!supported[k])
+			continue;
+		uint32_t state[8];
+		memcpy(state, H256, sizeof(state));
+		auto start = chrono::high_resolution_clock::now();
+		for (int i = 0; i < n / BLOCKS; i++)
+			fns[k](state, data, BLOCKS);
+		fns[k](state, data, n % BLOCKS);
+		auto end = chrono::high_resolution_clock::now();
+		double time = chrono::duration_cast<chrono::duration<double>>(end - start).count();
+		if (memcmp(state, ref, sizeof(state)))
+			cout << names[k] << ": digest mismatch" << endl;
+		cout << names[k] << ": " << time << endl;
+		cout << names[k] << ": " << n / time << " blocks/s" << endl;
+	}
 }
-*/
 
-int CheckForIntelShaExtensions()
+// A 64 KiB message in 1448-byte segments (one TCP MSS each): gathered into one buffer first,
+// against update_iov() on the segments where they lie
+void benchmark_iov(int n)
 {
-	int a, b, c, d;
-
-	// Look for CPUID.7.0.EBX[29]
-	// EAX = 7, ECX = 0
-	a = 7;
-	c = 0;
+	const int MSG = 64 << 10, SEG = 1448, SEGS = (MSG + SEG - 1) / SEG;
+	static uint8_t segs[SEGS][2 * SEG], gathered[MSG];
+	iovec iov[SEGS];
+	for (int i = 0; i < SEGS; i++)
+	{
+		// every other segment starts at an odd address, as in a real chain
+		iov[i].iov_base = segs[i] + i % 2;
+		iov[i].iov_len = min(SEG, MSG - i * SEG);
+		for (size_t j = 0; j < iov[i].iov_len; j++)
+			((uint8_t *)iov[i].iov_base)[j] = i + j;
+	}
+	int reps = max(1, n / (MSG / BLOCK_SIZE));
 
-	asm volatile("cpuid"
-				 : "=a"(a), "=b"(b), "=c"(c), "=d"(d)
-				 : "a"(a), "c"(c));
+	SHA256 copy;
+	auto start = chrono::high_resolution_clock::now();
+	for (int r = 0; r < reps; r++)
+	{
+		size_t off = 0;
+		for (int i = 0; i < SEGS; off += iov[i].iov_len, i++)
+			memcpy(gathered + off, iov[i].iov_base, iov[i].iov_len);
+		copy = SHA256();
+		copy.update(gathered, MSG);
+		copy.final();
+	}
+	auto end = chrono::high_resolution_clock::now();
+	double time1 = chrono::duration_cast<chrono::duration<double>>(end - start).count();
 
-	// Intel® SHA Extensions feature bit is EBX[29]
-	return ((b >> 29) & 1);
+	SHA256 sg;
+	start = chrono::high_resolution_clock::now();
+	for (int r = 0; r < reps; r++)
+	{
+		sg = SHA256();
+		sg.update_iov(iov, SEGS);
+		sg.final();
+	}
+	end = chrono::high_resolution_clock::now();
+	double time2 = chrono::duration_cast<chrono::duration<double>>(end - start).count();
+	if (memcmp(copy.state, sg.state, sizeof(sg.state)))
+		cout << "iov: digest mismatch" << endl;
+	cout << "iov gather + update: " << (double)reps * MSG / time1 / 1e6 << " MB/s" << endl;
+	cout << "iov update_iov: " << (double)reps * MSG / time2 / 1e6 << " MB/s" << endl;
 }
 
 void benchmark(int n = 1e6)
 {
+	sha256_dispatch_init();
+	cout << "backend: " << sha256_transform_name << ", multi-buffer: " << sha256_mb_name
+		 << ", sha512: " << sha512_transform_name << ", sha512 multi-buffer: " << sha512_mb_name << endl;
 	SHA256 sha256;
 	uint8_t data[BLOCK_SIZE];
 	for (int i = 0; i < BLOCK_SIZE; i++)
@@ -235,46 +477,112 @@ void benchmark(int n = 1e6)
 	double time1 = chrono::duration_cast<chrono::duration<double>>(end - start).count();
 	cout << "generic: " << time1 << endl;
 	cout << "generic: " << n / time1 << " blocks/s" << endl;
+	benchmark_simd(n, sha256.state);
 
 	if (!CheckForIntelShaExtensions())
-	{
 		cout << "No Intel SHA Extensions" << endl;
-		return;
+	else
+	{
+		sha256 = SHA256();
+		for (int i = 0; i < BLOCK_SIZE; i++)
+			data[i] = i;
+		start = chrono::high_resolution_clock::now();
+		for (int i = 0; i < n; i++)
+			sha256.processBlock_asm(data);
+		cout << hex;
+		cout.width(8);
+		cout.fill('0');
+		for (int i = 0; i < 8; i++)
+			cout << sha256.state[i];
+		cout << endl;
+		end = chrono::high_resolution_clock::now();
+		cout << dec;
+		cout.width(0);
+		double time2 = chrono::duration_cast<chrono::duration<double>>(end - start).count();
+		cout << "sha_ni: " << time2 << endl;
+		cout << "sha_ni: " << n / time2 << " blocks/s" << endl;
+
+		cout << "speedup: " << time1 / time2 << endl;
+		benchmark_ni_interleave(n);
 	}
 
-	sha256 = SHA256();
-	for (int i = 0; i < BLOCK_SIZE; i++)
-		data[i] = i;
+	// the same number of blocks as a stream through update(), 1 MiB per call
+	const int CHUNK = 1 << 20;
+	static uint8_t stream[CHUNK];
+	for (int i = 0; i < CHUNK; i++)
+		stream[i] = i;
+	SHA256 stream256;
+	uint64_t left = (uint64_t)n * BLOCK_SIZE;
 	start = chrono::high_resolution_clock::now();
-	for (int i = 0; i < n; i++)
-		sha256.processBlock_asm(data);
-	cout << hex;
-	cout.width(8);
-	cout.fill('0');
-	for (int i = 0; i < 8; i++)
-		cout << sha256.state[i];
-	cout << endl;
+	for (; left >= CHUNK; left -= CHUNK)
+		stream256.update(stream, CHUNK);
+	stream256.update(stream, left);
+	stream256.final();
 	end = chrono::high_resolution_clock::now();
-	cout << dec;
-	cout.width(0);
-	double time2 = chrono::duration_cast<chrono::duration<double>>(end - start).count();
-	cout << "sha_ni: " << time2 << endl;
-	cout << "sha_ni: " << n / time2 << " blocks/s" << endl;
+	double time5 = chrono::duration_cast<chrono::duration<double>>(end - start).count();
+	cout << "update (" << sha256_transform_name << "): " << time5 << endl;
+	cout << "update (" << sha256_transform_name << "): " << n / time5 << " blocks/s" << endl;
+	benchmark_iov(n);
+
+	benchmark_sha512(n);
+	benchmark_merkle(n);
+	benchmark_fixed<32>(n);
+	benchmark_fixed<64>(n);
+	benchmark_fixed<80>(n);
+	benchmark_sha256d(n);
+	benchmark_pbkdf2(n);
+
+	if (!CheckForAVX2())
+	{
+		cout << "No AVX2" << endl;
+		return;
+	}
+
+	double time3 = benchmark_mb(sha256_x8_avx2, MB_LANES_AVX2, n, data);
+	cout << "avx2_x8: " << time3 << endl;
+	cout << "avx2_x8: " << n / MB_LANES_AVX2 * MB_LANES_AVX2 / time3 << " blocks/s" << endl;
+
+	if (!CheckForAVX512())
+	{
+		cout << "No AVX-512" << endl;
+		return;
+	}
 
-	cout << "speedup: " << time1 / time2 << endl;
+	double time4 = benchmark_mb(sha256_x16_avx512, MB_LANES_AVX512, n, data);
+	cout << "avx512_x16: " << time4 << endl;
+	cout << "avx512_x16: " << n / MB_LANES_AVX512 * MB_LANES_AVX512 / time4 << " blocks/s" << endl;
+
+	if (CheckForIntelShaExtensions())
+		crossover(n);
+}
+
+static bool is_number(const char *s)
+{
+	if (!*s)
+		return false;
+	for (; *s; s++)
+		if (!isdigit(*s))
+			return false;
+	return true;
 }
 
 int main(int argc, char *argv[])
 {
-	if (argc != 2)
+	if (argc > 1 && !strcmp(argv[1], "-B"))
+		return sha256_bench(argc - 2, argv + 2);
+	if (argc == 1)
 	{
 		cout << "Usage: " << argv[0] << " n" << endl;
+		cout << "       " << argv[0] << " -B [-f table|csv|json] [-s min] [-S max] [-b backend,...] [-j threads] [-n reps]" << endl;
+		cout << "       " << argv[0] << " [-a] [-r] [-D] [-c cache] [-t] [-l] [-C chunk] [-j threads] [-k checkpoint [-K interval]] file... (- for stdin)" << endl;
 		benchmark();
 	}
-	else
+	else if (argc == 2 && is_number(argv[1]))
 	{
 		int n = atoi(argv[1]);
 		benchmark(n);
 	}
+	else
+		return sha256sum(argc - 1, argv + 1);
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,664 @@
+#ifndef _SHA256_H
+#define _SHA256_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdlib>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/uio.h>
+#else
+struct iovec
+{
+	void *iov_base;
+	size_t iov_len;
+};
+#endif
+
+const int BLOCK_SIZE = 64;
+const int DIGEST_SIZE = 32;
+const uint32_t K256[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+const uint32_t H256[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+#define ROTR(x, n) ((x >> n) | (x << (32 - n)))
+extern "C" void sha256_ni_transform(uint32_t *digest, const void *data, uint32_t numBlocks);
+
+// One block of the generic compression function
+static inline void sha256_compress(uint32_t *state, const uint8_t *block)
+{
+	uint32_t w[64];
+	for (int i = 0; i < 16; i++)
+	{
+		w[i] = (block[i * 4 + 0] << 24) | (block[i * 4 + 1] << 16) | (block[i * 4 + 2] << 8) | (block[i * 4 + 3] << 0);
+	}
+	for (int i = 16; i < 64; i++)
+	{
+		uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+	uint32_t a = state[0];
+	uint32_t b = state[1];
+	uint32_t c = state[2];
+	uint32_t d = state[3];
+	uint32_t e = state[4];
+	uint32_t f = state[5];
+	uint32_t g = state[6];
+	uint32_t h = state[7];
+	for (int i = 0; i < 64; i++)
+	{
+		uint32_t S1 = ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25);
+		uint32_t ch = (e & f) ^ ((~e) & g);
+		uint32_t temp1 = h + S1 + ch + K256[i] + w[i];
+		uint32_t S0 = ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22);
+		uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+		uint32_t temp2 = S0 + maj;
+		h = g;
+		g = f;
+		f = e;
+		e = d + temp1;
+		d = c;
+		c = b;
+		b = a;
+		a = temp1 + temp2;
+	}
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+	state[5] += f;
+	state[6] += g;
+	state[7] += h;
+}
+
+// The rounds of sha256_compress with a ready-made W + K
+static inline void sha256_compress_wk(uint32_t *state, const uint32_t *wk)
+{
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+	uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+#pragma GCC unroll 64
+	for (int i = 0; i < 64; i++)
+	{
+		uint32_t S1 = ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25);
+		uint32_t ch = (e & f) ^ ((~e) & g);
+		uint32_t temp1 = h + S1 + ch + wk[i];
+		uint32_t S0 = ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22);
+		uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+		uint32_t temp2 = S0 + maj;
+		h = g;
+		g = f;
+		f = e;
+		e = d + temp1;
+		d = c;
+		c = b;
+		b = a;
+		a = temp1 + temp2;
+	}
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+	state[5] += f;
+	state[6] += g;
+	state[7] += h;
+}
+
+// sha256_ni_transform with the System V calling convention on every platform
+static inline void sha256_ni_blocks(uint32_t *state, const void *data, uint32_t n)
+{
+#ifdef _WIN32
+	// convert to AMD64 ABI under Windows
+	// backup rdi, rsi, rdx, rax and xmms for safety
+	asm volatile(
+		"pushq %%rdi\n\t"
+		"pushq %%rsi\n\t"
+		"pushq %%rdx\n\t"
+		"pushq %%rax\n\t"
+		"subq $0x40, %%rsp\n\t"
+		"movdqu %%xmm6, (%%rsp)\n\t"
+		"movdqu %%xmm7, 0x10(%%rsp)\n\t"
+		"movdqu %%xmm8, 0x20(%%rsp)\n\t"
+		"movdqu %%xmm9, 0x30(%%rsp)\n\t"
+		:
+		:
+		: "memory");
+	asm volatile(
+		"mov %0, %%rdi\n\t"
+		"mov %1, %%rsi\n\t"
+		"mov %2, %%rdx\n\t"
+		"call sha256_ni_transform\n\t"
+		:
+		: "r"(state), "r"(data), "r"((uint64_t)n)
+		: "rdi", "rsi", "rdx");
+	// restore registers
+	asm volatile(
+		"movdqu (%%rsp), %%xmm6\n\t"
+		"movdqu 0x10(%%rsp), %%xmm7\n\t"
+		"movdqu 0x20(%%rsp), %%xmm8\n\t"
+		"movdqu 0x30(%%rsp), %%xmm9\n\t"
+		"addq $0x40, %%rsp\n\t"
+		"popq %%rax\n\t"
+		"popq %%rdx\n\t"
+		"popq %%rsi\n\t"
+		"popq %%rdi\n\t"
+		:
+		:
+		: "memory");
+#else
+	sha256_ni_transform(state, data, n);
+#endif
+}
+
+// Big-endian byte form of a digest
+static inline void digest_bytes(const uint32_t state[8], uint8_t out[DIGEST_SIZE])
+{
+	for (int i = 0; i < 8; i++)
+	{
+		out[i * 4 + 0] = state[i] >> 24;
+		out[i * 4 + 1] = state[i] >> 16;
+		out[i * 4 + 2] = state[i] >> 8;
+		out[i * 4 + 3] = state[i];
+	}
+}
+
+// Runtime dispatch (sha256_dispatch.cpp)
+// The CPU is probed once, on first use or by sha256_dispatch_init(), which any thread may call;
+// multi-threaded code calls it before starting workers. SHA256_BACKEND (generic, ssse3, avx, avx2,
+// sha_ni) and SHA256_MB_BACKEND (serial, avx2, sha_ni, avx512) force a backend if the CPU supports it.
+typedef void (*sha256_transform_fn)(uint32_t *state, const void *data, uint32_t numBlocks);
+typedef void (*sha256_mb_fn)(const uint8_t *const *msgs, const uint64_t *lens, uint32_t (*digests)[8], size_t count);
+struct CPUFeatures
+{
+	bool ssse3, avx, avx2, avx512, sha_ni;
+};
+extern CPUFeatures cpu_features;
+enum TransformId
+{
+	TRANSFORM_UNRESOLVED = -1,
+	TRANSFORM_GENERIC,
+	TRANSFORM_SHA_NI,
+	TRANSFORM_SSSE3,
+	TRANSFORM_AVX,
+	TRANSFORM_AVX2,
+};
+extern sha256_transform_fn sha256_transform;
+extern int sha256_transform_id; // which TransformId sha256_transform is
+extern sha256_mb_fn sha256_mb_hash;
+extern const char *sha256_transform_name;
+extern const char *sha256_mb_name;
+void sha256_dispatch_init();
+int CheckForIntelShaExtensions();
+int CheckForSSSE3();
+int CheckForAVX();
+int CheckForAVX2();
+int CheckForAVX512();
+void sha256_generic_transform(uint32_t *state, const void *data, uint32_t numBlocks);
+// Scalar rounds with the message schedule computed four words at a time (sha256_simd.cpp); the avx2
+// variant expands two blocks at once, one per 128-bit half, so the second block's rounds run without schedule work
+void sha256_ssse3_transform(uint32_t *state, const void *data, uint32_t numBlocks);
+void sha256_avx_transform(uint32_t *state, const void *data, uint32_t numBlocks);
+void sha256_avx2_transform(uint32_t *state, const void *data, uint32_t numBlocks);
+// Lanes for batches of short independent messages: 16 or 8 if the dispatcher picked a multi-buffer
+// kernel that beats the single-stream one, 1 for SHA-NI, 0 for generic
+int sha256_batch_lanes();
+struct SHA256
+{
+	uint32_t state[8];
+	uint8_t buffer[BLOCK_SIZE]; // partial block of the stream, totalBytes % BLOCK_SIZE bytes used
+	uint64_t totalBytes;        // bytes passed to update() so far
+
+	SHA256()
+	{
+		totalBytes = 0;
+		for (int i = 0; i < 8; i++)
+			state[i] = H256[i];
+	}
+
+	void processBlock(uint8_t *block)
+	{
+		sha256_compress(state, block);
+	}
+
+	void processBlock_asm(uint8_t *block)
+	{
+		processBlocks_asm(block, 1);
+	}
+
+	// Compress n consecutive blocks in one call, keeping the state in registers between blocks
+	void processBlocks_asm(const uint8_t *data, uint32_t n)
+	{
+		sha256_ni_blocks(state, data, n);
+	}
+
+	// Compress n consecutive blocks with the backend chosen at runtime
+	void processBlocks(const uint8_t *data, uint32_t n)
+	{
+		sha256_transform(state, data, n);
+	}
+
+	// Streaming interface: update() may be called any number of times, then final() leaves the digest in state.
+	// Partial blocks are buffered and every run of whole blocks goes to the transform in one call.
+	void update(const uint8_t *data, uint64_t len)
+	{
+		uint64_t used = totalBytes % BLOCK_SIZE;
+		totalBytes += len;
+		if (used)
+		{
+			uint64_t fill = BLOCK_SIZE - used < len ? BLOCK_SIZE - used : len;
+			memcpy(buffer + used, data, fill);
+			data += fill;
+			len -= fill;
+			if (used + fill < BLOCK_SIZE)
+				return;
+			processBlocks(buffer, 1);
+		}
+		uint64_t blocks = len / BLOCK_SIZE;
+		while (blocks)
+		{
+			uint32_t n = blocks < (1u << 30) ? blocks : (1u << 30);
+			processBlocks(data, n);
+			data += (uint64_t)n * BLOCK_SIZE;
+			blocks -= n;
+		}
+		memcpy(buffer, data, len % BLOCK_SIZE);
+	}
+
+	// Scatter/gather input, e.g. a received packet chain: each segment goes through update(), so only
+	// the bytes of a block that straddles two segments are copied and every run of whole blocks
+	// is hashed in place
+	void update_iov(const iovec *iov, int count)
+	{
+		for (int i = 0; i < count; i++)
+			update((const uint8_t *)iov[i].iov_base, iov[i].iov_len);
+	}
+
+	void final()
+	{
+		uint64_t used = totalBytes % BLOCK_SIZE;
+		buffer[used++] = 0x80;
+		if (used > 56)
+		{
+			memset(buffer + used, 0, BLOCK_SIZE - used);
+			processBlocks(buffer, 1);
+			used = 0;
+		}
+		memset(buffer + used, 0, 56 - used);
+		uint64_t bitLen = totalBytes * 8;
+		for (int i = 0; i < 8; i++)
+			buffer[56 + i] = (bitLen >> ((7 - i) * 8)) & 0xFF;
+		processBlocks(buffer, 1);
+	}
+
+	void sha256(uint8_t *data, uint64_t len)
+	{
+		uint64_t i = 0;
+		while (len - i >= BLOCK_SIZE)
+		{
+			processBlock(data + i);
+			i += BLOCK_SIZE;
+		}
+		uint8_t block[BLOCK_SIZE] = {0};
+		uint64_t rem = len - i;
+		for (uint64_t j = 0; j < rem; j++)
+		{
+			block[j] = data[i + j];
+		}
+		block[rem] = 0x80;
+		uint64_t bitLen = len * 8;
+		if (rem < 56)
+		{
+			for (int i = 0; i < 8; i++)
+			{
+				block[56 + i] = (bitLen >> ((7 - i) * 8)) & 0xFF;
+			}
+			processBlock(block);
+		}
+		else
+		{
+			processBlock(block);
+			for (int i = 0; i < 56; i++)
+			{
+				block[i] = 0;
+			}
+			for (int i = 0; i < 8; i++)
+			{
+				block[56 + i] = (bitLen >> ((7 - i) * 8)) & 0xFF;
+			}
+			processBlock(block);
+		}
+	}
+};
+
+// Multi-buffer backends (sha256_mb.cpp)
+// Lane-parallel state is stored word-major: state[j * lanes + lane] is word j of that lane.
+const int MB_LANES_AVX2 = 8;
+const int MB_LANES_AVX512 = 16;
+
+// Run n block steps on 8 or 16 lanes at once. Lane l compresses min(n, nblocks[l]) consecutive
+// blocks starting at data[l]; a lane whose count has run out keeps its state unchanged.
+typedef void (*mb_kernel)(uint32_t *state, const uint8_t *const *data, const uint64_t *nblocks, uint64_t n);
+void sha256_x8_avx2(uint32_t *state, const uint8_t *const *data, const uint64_t *nblocks, uint64_t n);
+void sha256_x16_avx512(uint32_t *state, const uint8_t *const *data, const uint64_t *nblocks, uint64_t n);
+// One block on every lane that differs only in word 0, the last block of a 65-byte message (sha256_fixed.h)
+void sha256_x8_avx2_tail65(uint32_t *state, const uint32_t *w0);
+void sha256_x16_avx512_tail65(uint32_t *state, const uint32_t *w0);
+// SHA-NI with 2 streams interleaved in one instruction stream to hide the sha256rnds2 latency
+const int NI_LANES_X2 = 2;
+void sha256_ni_x2(uint32_t *state, const uint8_t *const *data, const uint64_t *nblocks, uint64_t n);
+
+// Hash count independent messages, 8 or 16 at a time. digests[i] receives the final state words of msgs[i].
+void sha256_mb_avx2(const uint8_t *const *msgs, const uint64_t *lens, uint32_t (*digests)[8], size_t count);
+void sha256_mb_avx512(const uint8_t *const *msgs, const uint64_t *lens, uint32_t (*digests)[8], size_t count);
+void sha256_mb_sha_ni(const uint8_t *const *msgs, const uint64_t *lens, uint32_t (*digests)[8], size_t count);
+void sha256_mb_serial(const uint8_t *const *msgs, const uint64_t *lens, uint32_t (*digests)[8], size_t count);
+
+// File hashing (sha256_file.cpp)
+// Regular files are hashed straight from a memory mapping, anything else through read().
+bool sha256_fd(int fd, uint32_t digest[8]);
+bool sha256_file(const char *path, uint32_t digest[8]); // "-" is stdin
+void print_digest(const uint32_t digest[8]);
+int sha256sum(int argc, char *argv[]); // [-a] [-r] [-D] [-c cache] [-t] [-l] [-C chunk] [-j threads] [-k checkpoint [-K interval]] file...
+
+// Digest cache (sha256_cache.cpp): an append-only file mapping (device, inode, size, mtime) to the
+// digest, so unchanged files are not read again. The layout is documented at the top of sha256_cache.cpp.
+// A record whose size or mtime no longer matches counts as stale and is superseded by the next store().
+struct DigestCacheIndex;
+class DigestCache
+{
+public:
+	DigestCache();
+	~DigestCache(); // close()
+	bool open(const char *path); // created if missing; holds an exclusive lock on it until close()
+	void close();
+	// Both are thread-safe. store() skips files modified within the last seconds before open().
+	bool lookup(const struct stat &st, uint32_t digest[8]);
+	void store(const struct stat &st, const uint32_t digest[8]);
+	uint64_t hits, misses, stale;
+
+private:
+	std::string path;
+	int fd;
+	DigestCacheIndex *index;
+	bool load();
+	void compact();
+	DigestCache(const DigestCache &);
+	DigestCache &operator=(const DigestCache &);
+};
+
+// Recursive hashing (sha256_dir.cpp): every regular file below root on a work-stealing pool of threads
+// workers (0: one per core), small files batched through sha256_mb_hash, cache consulted if not NULL.
+// Errors are reported on stderr and make the result false; the manifest still lists every file that
+// could be hashed, sorted by path.
+struct ManifestEntry
+{
+	std::string path;
+	uint32_t digest[8];
+};
+bool sha256_dir(const char *root, int threads, DigestCache *cache, std::vector<ManifestEntry> &manifest);
+
+static inline int64_t stat_mtime_ns(const struct stat &st)
+{
+#if defined(__APPLE__)
+	return st.st_mtimespec.tv_sec * 1000000000ll + st.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+	return st.st_mtime * 1000000000ll;
+#else
+	return st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec;
+#endif
+}
+
+// Checkpoints (sha256_checkpoint.cpp): a versioned binary image of an in-progress SHA256, at most
+// SHA256_CHECKPOINT_MAX bytes, together with the identity of the input it belongs to.
+// The layout is documented at the top of sha256_checkpoint.cpp.
+const int SHA256_CHECKPOINT_VERSION = 2;
+const int SHA256_CHECKPOINT_MAX = 80 + BLOCK_SIZE + 8;
+struct CheckpointSource
+{
+	uint64_t size, dev, ino;
+	int64_t mtime; // nanoseconds
+	bool operator==(const CheckpointSource &o) const
+	{
+		return size == o.size && dev == o.dev && ino == o.ino && mtime == o.mtime;
+	}
+};
+bool checkpoint_source(int fd, CheckpointSource &src); // all zero for anything but a regular file
+size_t sha256_checkpoint_save(const SHA256 &ctx, const CheckpointSource &src, uint8_t out[SHA256_CHECKPOINT_MAX]); // returns the size
+bool sha256_checkpoint_load(SHA256 &ctx, CheckpointSource &src, const uint8_t *in, size_t len); // false: bad version or check value
+bool sha256_checkpoint_write(const SHA256 &ctx, const CheckpointSource &src, const char *path);
+int sha256_checkpoint_read(SHA256 &ctx, CheckpointSource &src, const char *path); // 1: loaded, 0: no file, -1: invalid
+// Hash fd, writing a checkpoint to path every interval bytes (0: never). If path holds a checkpoint the
+// hash resumes from it at byte offset ctx.totalBytes of fd, provided fd is still the same unmodified
+// file and reaches that offset; otherwise it fails and leaves the checkpoint alone. A path that exists but
+// is not a checkpoint fails the same way. The checkpoint is removed once the digest is done.
+bool sha256_fd_resumable(int fd, const char *path, uint64_t interval, uint32_t digest[8]);
+
+// Pipeline helpers (sha256_pipeline.cpp), shared by the async reader, the dedup chunker and the tree hash
+static inline double seconds_since(std::chrono::steady_clock::time_point t)
+{
+	return std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - t).count();
+}
+// read() into buf until it holds size bytes or the input ends, retrying on EINTR; returns the bytes read.
+// eof is set when the input ended, error as well if it ended in a failed read().
+size_t read_fill(int fd, uint8_t *buf, size_t size, bool &eof, bool &error);
+// A ring of N slots handed between pipeline stages under one lock. Slot needs a uint8_t *data member,
+// which alloc() points at a page-aligned buffer of size bytes.
+template <class Slot, int N>
+struct SlotRing
+{
+	Slot slot[N] = {};
+	std::mutex m;
+	std::condition_variable cv;
+	bool error = false;
+
+	~SlotRing()
+	{
+		for (int i = 0; i < N; i++)
+			free(slot[i].data);
+	}
+	bool alloc(size_t size)
+	{
+		for (int i = 0; i < N; i++)
+			if (posix_memalign((void **)&slot[i].data, 4096, size))
+				return false;
+		return true;
+	}
+	// Block until ready() holds; the lock is still held on return
+	template <class Ready>
+	std::unique_lock<std::mutex> wait(Ready ready)
+	{
+		std::unique_lock<std::mutex> lock(m);
+		cv.wait(lock, ready);
+		return lock;
+	}
+	// Apply change under the lock and wake every stage
+	template <class Change>
+	void publish(Change change)
+	{
+		std::lock_guard<std::mutex> lock(m);
+		change();
+		cv.notify_all();
+	}
+};
+
+// Double-buffered pipeline (sha256_pipeline.cpp): a reader thread overlaps read() with hashing.
+// All times are in seconds.
+struct PipelineStats
+{
+	double read;      // reader thread inside read()
+	double hash_wait; // reader thread waiting for a free buffer (hashing is the bottleneck)
+	double hash;      // hashing thread inside update()
+	double io_wait;   // hashing thread waiting for data (I/O is the bottleneck)
+	double total;
+	uint64_t bytes;
+};
+bool sha256_fd_async(int fd, uint32_t digest[8], PipelineStats *stats);
+
+// Content-defined chunking and dedup (sha256_cdc.cpp): FastCDC cut points from a Gear rolling hash,
+// every chunk hashed through sha256_mb_hash and looked up in an in-memory index. Reading and chunking,
+// hashing (hashThreads threads, 0: all cores but two) and indexing run as pipelined stages.
+const uint32_t CDC_MAX_CHUNK = 1 << 20;
+struct CDCParams
+{
+	uint32_t minSize, avgSize, maxSize; // avgSize a power of two, maxSize at most CDC_MAX_CHUNK
+};
+const CDCParams CDC_DEFAULT = {2048, 8192, 65536};
+struct CDCChunk
+{
+	uint64_t offset;
+	uint32_t length;
+	uint32_t digest[8];
+	bool duplicate; // the index already held this digest
+};
+// Digest to chunk length; shared by every stream hashed with it, so duplicates are found across files
+struct ChunkIndex
+{
+	struct Key
+	{
+		uint32_t d[8];
+		bool operator==(const Key &o) const { return !memcmp(d, o.d, sizeof(d)); }
+	};
+	struct KeyHash
+	{
+		size_t operator()(const Key &k) const { return ((uint64_t)k.d[0] << 32) | k.d[1]; }
+	};
+	std::unordered_map<Key, uint32_t, KeyHash> chunks;
+};
+// Per stream; times in seconds, each the busy time of its stage, hash summed over the hashing threads
+struct DedupStats
+{
+	uint64_t bytes, chunks, uniqueBytes, uniqueChunks;
+	double read, chunk, hash, index, total;
+};
+bool cdc_valid(const CDCParams &params);
+size_t cdc_cut(const uint8_t *data, size_t len, const CDCParams &params); // length of the next chunk
+// onChunk, if set, sees every chunk in stream order on the calling thread
+bool sha256_dedup_fd(int fd, const CDCParams &params, int hashThreads, ChunkIndex &index, DedupStats *stats,
+					 const std::function<void(const CDCChunk &)> &onChunk);
+
+// Benchmark suite (sha256_bench.cpp): message sizes from 0 B to 1 GiB across the single-stream and
+// multi-buffer backends, OpenSSL's libcrypto if it can be loaded, and 1, 2, 4 .. threads threads.
+// Reports the median and minimum of reps repetitions as a table, CSV or JSON.
+int sha256_bench(int argc, char *argv[]); // [-f table|csv|json] [-s min] [-S max] [-b backend,...] [-j threads] [-n reps]
+// Core cycles of the calling thread from perf_event, as in instbench; -1 where the counter is unavailable
+int open_cycle_counter();
+uint64_t read_cycles(int fd); // 0 if fd is -1
+
+// Tree hash (sha256_tree.cpp): fixed-size chunks hashed in parallel and combined into a Merkle root.
+// The layout is documented at the top of sha256_tree.cpp.
+struct TreeHash
+{
+	uint64_t chunkSize;           // bytes per leaf, a multiple of the page size
+	std::vector<uint32_t> leaves; // 8 words per chunk digest
+	uint32_t root[8];
+};
+// Run fn(0) .. fn(count - 1) on threads threads (0: one per core)
+void parallel_for(size_t count, int threads, const std::function<void(size_t)> &fn);
+void merkle_root(const uint32_t (*leaves)[8], size_t count, uint32_t root[8]);
+
+// Domain separation prefixes hashed in front of leaf data and of a node's two children
+const uint8_t MERKLE_LEAF = 0x00;
+const uint8_t MERKLE_NODE = 0x01;
+
+// Batch Merkle builder over big-endian digest bytes. sha256_prefixed_batch() hashes prefix || 64-byte
+// message for count messages: the first block goes through the multi-buffer or SHA-NI kernel, the second
+// differs only in word 0, so its schedule is mostly constant (Tail65).
+void sha256_prefixed_batch(uint8_t prefix, const uint8_t *msgs, size_t count, uint8_t *digests);
+size_t merkle_level(const uint8_t *nodes, size_t count, uint8_t *parents); // returns the parent count
+void merkle_root32(const uint8_t *leaves, size_t count, uint8_t root[DIGEST_SIZE]); // leaves are leaf hashes; none: SHA-256("")
+void merkle_root64(const uint8_t *leaves, size_t count, uint8_t root[DIGEST_SIZE]); // leaves hashed first
+bool sha256_tree_fd(int fd, TreeHash &tree, int threads);
+
+// Double SHA-256 nonce search (sha256_pow.cpp)
+// An 80-byte header hashes as SHA-256(SHA-256(header)) with a little-endian 32-bit nonce at byte 76.
+// The state after the first 64 bytes (the midstate) is the same for every nonce, so a candidate
+// costs the second block from the midstate plus the single block of the outer hash.
+const int POW_HEADER_SIZE = 80;
+const int POW_NONCE_OFFSET = 76;
+// 8 or 16 consecutive nonces from nonce0; tail[0..2] are the big-endian words of header bytes 64..75.
+// out receives the final state words, word-major like the other lane kernels.
+void sha256d_x8_avx2(const uint32_t mid[8], const uint32_t tail[3], uint32_t nonce0, uint32_t *out);
+void sha256d_x16_avx512(const uint32_t mid[8], const uint32_t tail[3], uint32_t nonce0, uint32_t *out);
+struct NonceResult
+{
+	bool found;
+	uint32_t nonce;
+	uint8_t hash[DIGEST_SIZE]; // double SHA-256 of the header with that nonce
+	uint64_t hashes;           // candidates tried by all threads
+};
+void sha256d(const uint8_t header[POW_HEADER_SIZE], uint8_t out[DIGEST_SIZE]);
+// Try count nonces from start and stop at the first whose hash, read as a little-endian 256-bit
+// number, is <= target (also little-endian). backend is generic, sha_ni, avx2, avx512 or NULL for
+// the fastest the dispatcher allows; threads 0 means one per core. With one thread the lowest
+// matching nonce is returned, with more any matching one.
+bool sha256d_search(const uint8_t header[POW_HEADER_SIZE], const uint8_t target[DIGEST_SIZE], uint32_t start, uint64_t count,
+					int threads, const char *backend, NonceResult &result);
+bool sha256d_supported(const char *backend);
+
+// HMAC-SHA256 and PBKDF2-HMAC-SHA256 (sha256_hmac.cpp)
+// A key is reduced once to the states after its ipad and opad blocks, so a MAC costs the message
+// blocks plus one outer block instead of two extra pad compressions.
+struct HMACKey
+{
+	uint32_t inner[8]; // state after the block key ^ 0x36..
+	uint32_t outer[8]; // state after the block key ^ 0x5c..
+	HMACKey(const uint8_t *key, size_t len);
+};
+struct HMAC_SHA256
+{
+	const HMACKey &key;
+	SHA256 inner;
+
+	HMAC_SHA256(const HMACKey &key);
+	void update(const uint8_t *data, uint64_t len)
+	{
+		inner.update(data, len);
+	}
+	void final(uint8_t mac[DIGEST_SIZE]);
+};
+void hmac_sha256(const HMACKey &key, const uint8_t *msg, uint64_t len, uint8_t mac[DIGEST_SIZE]);
+// Every U_i is 32 bytes, so an iteration is exactly one inner and one outer block from the cached
+// states. Independent chains (output blocks, and in the batch form also passwords) share the lanes
+// of the multi-buffer kernel or run back to back on SHA-NI.
+void pbkdf2_hmac_sha256(const uint8_t *password, size_t passwordLen, const uint8_t *salt, size_t saltLen,
+						uint64_t iterations, uint8_t *out, size_t outLen);
+struct PBKDF2Job
+{
+	const uint8_t *password;
+	size_t passwordLen;
+	const uint8_t *salt;
+	size_t saltLen;
+	uint8_t *out;
+	size_t outLen;
+};
+void pbkdf2_hmac_sha256_batch(const PBKDF2Job *jobs, size_t count, uint64_t iterations);
+void pbkdf2_x8_avx2(const uint32_t *ipad, const uint32_t *opad, uint32_t *u, uint32_t *t, uint64_t iterations);
+void pbkdf2_x16_avx512(const uint32_t *ipad, const uint32_t *opad, uint32_t *u, uint32_t *t, uint64_t iterations);
+
+#endif
@@ -0,0 +1,474 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <x86intrin.h>
+#include <cpuid.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <dlfcn.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+#include "sha256.h"
+using namespace std;
+
+int open_cycle_counter()
+{
+#ifndef _WIN32
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_CPU_CYCLES;
+	attr.exclude_kernel = 1;
+	return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+	return -1;
+#endif
+}
+
+uint64_t read_cycles(int fd)
+{
+	uint64_t c = 0;
+#ifndef _WIN32
+	if (fd >= 0 && read(fd, &c, sizeof(c)) != sizeof(c))
+		c = 0;
+#endif
+	return c;
+}
+
+// Benchmark suite: every (backend, message size, thread count) is warmed up, then timed in reps
+// repetitions of a calibrated number of operations. One operation hashes one message per lane from
+// scratch to the final digest. Each repetition yields wall time, rdtsc ticks and, where perf_event
+// allows it, core cycles summed over the threads; medians and minima go to the report.
+
+const double WARMUP_SECONDS = 0.05;
+const double REP_SECONDS = 0.02;
+
+enum CaseKind
+{
+	CASE_STREAM,  // SHA256::update() + final() with sha256_transform switched to one backend
+	CASE_MB,      // lanes messages of the same size at once through a multi-buffer backend
+	CASE_OPENSSL, // SHA256() from a libcrypto found at run time
+};
+
+typedef unsigned char *(*openssl_sha256_fn)(const unsigned char *d, size_t n, unsigned char *md);
+
+struct BenchCase
+{
+	string name;
+	CaseKind kind;
+	sha256_transform_fn transform;
+	int transformId;
+	sha256_mb_fn mb;
+	int lanes;
+	openssl_sha256_fn openssl;
+};
+
+struct BenchResult
+{
+	string backend;
+	uint64_t size;
+	int threads, reps;
+	uint64_t iters;           // operations per thread and repetition
+	double nsMedian, nsMin;   // per operation
+	double mbps;              // MB/s over all threads, median repetition
+	double ticksPerByte;      // rdtsc, first thread
+	double cyclesPerByte;     // perf cycles summed over threads; -1 if unavailable
+	double cyclesPerMsg;      // the same per message, meaningful at size 0
+	bool ok;                  // digest matched the dispatched backend's
+};
+
+struct BenchOptions
+{
+	uint64_t minSize = 0, maxSize = 1ull << 30;
+	int maxThreads = 0, reps = 7;
+	string format = "table";
+	vector<string> backends; // empty: all supported
+};
+
+static const char *openssl_version = NULL;
+
+static openssl_sha256_fn load_openssl()
+{
+#ifndef _WIN32
+	const char *names[] = {"libcrypto.so.3", "libcrypto.so", "libcrypto.so.1.1", "libcrypto.dylib"};
+	for (const char *name : names)
+	{
+		void *lib = dlopen(name, RTLD_NOW | RTLD_LOCAL);
+		if (!lib)
+			continue;
+		openssl_sha256_fn fn = (openssl_sha256_fn)dlsym(lib, "SHA256");
+		typedef const char *(*version_fn)(int);
+		version_fn version = (version_fn)dlsym(lib, "OpenSSL_version");
+		if (!version)
+			version = (version_fn)dlsym(lib, "SSLeay_version");
+		openssl_version = version ? version(0) : name;
+		if (fn)
+			return fn;
+		dlclose(lib);
+	}
+#endif
+	return NULL;
+}
+
+static vector<BenchCase> bench_cases()
+{
+	sha256_dispatch_init();
+	vector<BenchCase> cases;
+	struct
+	{
+		const char *name;
+		sha256_transform_fn fn;
+		int id;
+		bool supported;
+	} streams[] = {
+		{"generic", sha256_generic_transform, TRANSFORM_GENERIC, true},
+		{"ssse3", sha256_ssse3_transform, TRANSFORM_SSSE3, cpu_features.ssse3},
+		{"avx", sha256_avx_transform, TRANSFORM_AVX, cpu_features.avx},
+		{"avx2", sha256_avx2_transform, TRANSFORM_AVX2, cpu_features.avx2},
+		{"sha_ni", sha256_ni_blocks, TRANSFORM_SHA_NI, cpu_features.sha_ni},
+	};
+	for (auto &s : streams)
+		if (s.supported)
+			cases.push_back({s.name, CASE_STREAM, s.fn, s.id, NULL, 1, NULL});
+	struct
+	{
+		const char *name;
+		sha256_mb_fn fn;
+		int lanes;
+		bool supported;
+	} mbs[] = {
+		{"mb_sha_ni_x2", sha256_mb_sha_ni, NI_LANES_X2, cpu_features.sha_ni},
+		{"mb_avx2_x8", sha256_mb_avx2, MB_LANES_AVX2, cpu_features.avx2},
+		{"mb_avx512_x16", sha256_mb_avx512, MB_LANES_AVX512, cpu_features.avx512},
+	};
+	for (auto &m : mbs)
+		if (m.supported)
+			cases.push_back({m.name, CASE_MB, NULL, TRANSFORM_UNRESOLVED, m.fn, m.lanes, NULL});
+	if (openssl_sha256_fn fn = load_openssl())
+		cases.push_back({"openssl", CASE_OPENSSL, NULL, TRANSFORM_UNRESOLVED, NULL, 1, fn});
+	return cases;
+}
+
+// One operation; digest receives the first lane's result
+static void run_op(const BenchCase &c, const uint8_t *data, uint64_t size, uint32_t digest[8])
+{
+	switch (c.kind)
+	{
+	case CASE_STREAM:
+	{
+		SHA256 sha256;
+		sha256.update(data, size);
+		sha256.final();
+		memcpy(digest, sha256.state, sizeof(sha256.state));
+		break;
+	}
+	case CASE_MB:
+	{
+		const uint8_t *msgs[MB_LANES_AVX512];
+		uint64_t lens[MB_LANES_AVX512];
+		uint32_t digests[MB_LANES_AVX512][8];
+		for (int l = 0; l < c.lanes; l++)
+		{
+			msgs[l] = data;
+			lens[l] = size;
+		}
+		c.mb(msgs, lens, digests, c.lanes);
+		memcpy(digest, digests[0], sizeof(digests[0]));
+		break;
+	}
+	case CASE_OPENSSL:
+	{
+		uint8_t md[DIGEST_SIZE];
+		c.openssl(data, size, md);
+		for (int i = 0; i < 8; i++)
+			digest[i] = (md[i * 4] << 24) | (md[i * 4 + 1] << 16) | (md[i * 4 + 2] << 8) | md[i * 4 + 3];
+		break;
+	}
+	}
+}
+
+static double median(vector<double> v)
+{
+	sort(v.begin(), v.end());
+	size_t n = v.size();
+	return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+struct ThreadSample
+{
+	chrono::steady_clock::time_point start, end;
+	uint64_t ticks, cycles;
+	bool cyclesValid;
+};
+
+static BenchResult measure(const BenchCase &c, const uint8_t *data, uint64_t size, int threads, int reps, const uint32_t ref[8])
+{
+	BenchResult r;
+	r.backend = c.name;
+	r.size = size;
+	r.threads = threads;
+	r.reps = reps;
+
+	// warm up caches, page mappings and the clock, and find how many operations fill a repetition
+	uint32_t digest[8];
+	uint64_t warm = 0;
+	auto t = chrono::steady_clock::now();
+	double elapsed;
+	do
+	{
+		run_op(c, data, size, digest);
+		warm++;
+	} while ((elapsed = seconds_since(t)) < WARMUP_SECONDS);
+	r.ok = !memcmp(digest, ref, sizeof(digest));
+	r.iters = max<uint64_t>(1, REP_SECONDS / (elapsed / warm));
+
+	vector<double> ns, mbps, ticks, cycles, cyclesMsg;
+	uint64_t bytesPerOp = size * c.lanes;
+	for (int rep = 0; rep < reps; rep++)
+	{
+		vector<ThreadSample> samples(threads);
+		atomic<int> ready(0);
+		atomic<bool> go(false);
+		auto body = [&](int i)
+		{
+			int fd = open_cycle_counter();
+			uint32_t d[8];
+			ready++;
+			while (!go)
+				;
+			ThreadSample &s = samples[i];
+			s.start = chrono::steady_clock::now();
+			uint64_t c0 = read_cycles(fd), t0 = __rdtsc();
+			for (uint64_t k = 0; k < r.iters; k++)
+				run_op(c, data, size, d);
+			uint64_t t1 = __rdtsc(), c1 = read_cycles(fd);
+			s.end = chrono::steady_clock::now();
+			s.ticks = t1 - t0;
+			s.cycles = c1 - c0;
+			s.cyclesValid = fd >= 0;
+			if (fd >= 0)
+				close(fd);
+		};
+		vector<thread> pool;
+		for (int i = 1; i < threads; i++)
+			pool.emplace_back(body, i);
+		while (ready < threads - 1)
+			;
+		go = true;
+		body(0);
+		for (auto &th : pool)
+			th.join();
+
+		auto first = samples[0].start, last = samples[0].end;
+		uint64_t cyc = 0;
+		bool valid = true;
+		for (auto &s : samples)
+		{
+			first = min(first, s.start);
+			last = max(last, s.end);
+			cyc += s.cycles;
+			valid = valid && s.cyclesValid;
+		}
+		double secs = chrono::duration_cast<chrono::duration<double>>(last - first).count();
+		double totalBytes = (double)bytesPerOp * r.iters * threads;
+		ns.push_back(chrono::duration_cast<chrono::duration<double, nano>>(samples[0].end - samples[0].start).count() / r.iters);
+		mbps.push_back(totalBytes / secs / 1e6);
+		ticks.push_back(bytesPerOp ? (double)samples[0].ticks / (bytesPerOp * r.iters) : 0);
+		cycles.push_back(valid && bytesPerOp ? cyc / totalBytes : -1);
+		cyclesMsg.push_back(valid ? (double)cyc / ((double)c.lanes * r.iters * threads) : -1);
+	}
+	r.nsMedian = median(ns);
+	r.nsMin = *min_element(ns.begin(), ns.end());
+	r.mbps = median(mbps);
+	r.ticksPerByte = median(ticks);
+	r.cyclesPerByte = median(cycles);
+	r.cyclesPerMsg = median(cyclesMsg);
+	return r;
+}
+
+static string cpu_brand()
+{
+	unsigned int regs[12];
+	if (__get_cpuid_max(0x80000000, NULL) < 0x80000004)
+		return "unknown";
+	for (int i = 0; i < 3; i++)
+		__get_cpuid(0x80000002 + i, &regs[i * 4], &regs[i * 4 + 1], &regs[i * 4 + 2], &regs[i * 4 + 3]);
+	string s((const char *)regs, sizeof(regs));
+	s = s.c_str();
+	s.erase(0, s.find_first_not_of(' '));
+	return s;
+}
+
+static string json_string(const string &s)
+{
+	string out = "\"";
+	for (char ch : s)
+	{
+		if (ch == '"' || ch == '\\')
+			out += '\\';
+		out += ch;
+	}
+	return out + "\"";
+}
+
+static void print_result(const BenchOptions &o, const BenchResult &r, bool first)
+{
+	if (o.format == "csv")
+		cout << r.backend << "," << r.size << "," << r.threads << "," << r.reps << "," << r.iters << "," << r.nsMedian << ","
+			 << r.nsMin << "," << r.mbps << "," << r.ticksPerByte << "," << r.cyclesPerByte << "," << r.cyclesPerMsg << ","
+			 << (r.ok ? "true" : "false") << endl;
+	else if (o.format == "json")
+		cout << (first ? "" : ",\n") << "    {\"backend\": " << json_string(r.backend) << ", \"size\": " << r.size
+			 << ", \"threads\": " << r.threads << ", \"reps\": " << r.reps << ", \"iters\": " << r.iters
+			 << ", \"ns_median\": " << r.nsMedian << ", \"ns_min\": " << r.nsMin << ", \"mb_per_s\": " << r.mbps
+			 << ", \"ticks_per_byte\": " << r.ticksPerByte << ", \"cycles_per_byte\": " << r.cyclesPerByte
+			 << ", \"cycles_per_msg\": " << r.cyclesPerMsg << ", \"ok\": " << (r.ok ? "true" : "false") << "}" << flush;
+	else
+		cout << r.backend << "\t" << r.size << "\t" << r.threads << "\t" << r.nsMedian << "\t" << r.nsMin << "\t" << r.mbps
+			 << "\t" << r.ticksPerByte << "\t" << r.cyclesPerByte << "\t" << r.cyclesPerMsg << (r.ok ? "" : "\tMISMATCH") << endl;
+}
+
+static bool parse_bench_options(int argc, char *argv[], BenchOptions &o)
+{
+	for (int i = 0; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-f") && i + 1 < argc)
+			o.format = argv[++i];
+		else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+			o.minSize = strtoull(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-S") && i + 1 < argc)
+			o.maxSize = strtoull(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+			o.maxThreads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+			o.reps = max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "-b") && i + 1 < argc)
+		{
+			stringstream list(argv[++i]);
+			for (string b; getline(list, b, ',');)
+				o.backends.push_back(b);
+		}
+		else
+		{
+			cerr << "unknown option " << argv[i] << endl;
+			return false;
+		}
+	}
+	if (o.format != "table" && o.format != "csv" && o.format != "json")
+	{
+		cerr << "format must be table, csv or json" << endl;
+		return false;
+	}
+	return true;
+}
+
+int sha256_bench(int argc, char *argv[])
+{
+	BenchOptions o;
+	if (!parse_bench_options(argc, argv, o))
+		return 2;
+	vector<BenchCase> cases = bench_cases();
+	if (!o.backends.empty())
+	{
+		vector<BenchCase> chosen;
+		for (auto &name : o.backends)
+		{
+			auto it = find_if(cases.begin(), cases.end(), [&](const BenchCase &c)
+							  { return c.name == name; });
+			if (it == cases.end())
+			{
+				cerr << "backend " << name << " is not available" << endl;
+				return 2;
+			}
+			chosen.push_back(*it);
+		}
+		cases = chosen;
+	}
+
+	// sizes around the padding boundaries, then powers of four up to 1 GiB
+	vector<uint64_t> sizes = {0, 1, 16, 55, 56, 64, 128, 256, 512};
+	for (uint64_t s = 1 << 10; s <= (1ull << 30); s *= 4)
+		sizes.push_back(s);
+	sizes.erase(remove_if(sizes.begin(), sizes.end(), [&](uint64_t s)
+						  { return s < o.minSize || s > o.maxSize; }),
+				sizes.end());
+	int cores = o.maxThreads > 0 ? o.maxThreads : max(1u, thread::hardware_concurrency());
+	vector<int> threadCounts;
+	for (int t = 1; t < cores; t *= 2)
+		threadCounts.push_back(t);
+	threadCounts.push_back(cores);
+	if (sizes.empty())
+		return 0;
+
+	uint8_t *data;
+	if (posix_memalign((void **)&data, 4096, max<uint64_t>(sizes.back(), 1)))
+	{
+		cerr << "cannot allocate " << sizes.back() << " bytes" << endl;
+		return 1;
+	}
+	for (uint64_t i = 0; i < sizes.back(); i++)
+		data[i] = i * 131 + (i >> 12);
+
+	int probe = open_cycle_counter();
+	bool haveCycles = probe >= 0;
+	if (probe >= 0)
+		close(probe);
+	string cpu = cpu_brand();
+	if (o.format == "json")
+	{
+		cout << "{\n  \"cpu\": " << json_string(cpu) << ",\n  \"compiler\": " << json_string(__VERSION__)
+			 << ",\n  \"openssl\": " << (openssl_version ? json_string(openssl_version) : "null")
+			 << ",\n  \"perf_cycles\": " << (haveCycles ? "true" : "false") << ",\n  \"results\": [\n";
+	}
+	else if (o.format == "csv")
+		cout << "backend,size,threads,reps,iters,ns_median,ns_min,mb_per_s,ticks_per_byte,cycles_per_byte,cycles_per_msg,ok" << endl;
+	else
+	{
+		cout << "cpu: " << cpu << ", compiler: " << __VERSION__ << ", openssl: " << (openssl_version ? openssl_version : "not found")
+			 << (haveCycles ? "" : ", perf cycles unavailable") << endl;
+		cout << "backend\tsize\tthreads\tns/op\tmin ns/op\tMB/s\tticks/B\tcycles/B\tcycles/msg" << endl;
+	}
+
+	sha256_transform_fn savedTransform = sha256_transform;
+	int savedId = sha256_transform_id;
+	bool first = true;
+	int status = 0;
+	for (uint64_t size : sizes)
+	{
+		uint32_t ref[8];
+		SHA256 sha256;
+		sha256.update(data, size);
+		sha256.final();
+		memcpy(ref, sha256.state, sizeof(ref));
+		for (auto &c : cases)
+		{
+			if (c.kind == CASE_STREAM)
+			{
+				sha256_transform = c.transform;
+				sha256_transform_id = c.transformId;
+			}
+			for (int threads : threadCounts)
+			{
+				BenchResult r = measure(c, data, size, threads, o.reps, ref);
+				if (!r.ok)
+					status = 1;
+				print_result(o, r, first);
+				first = false;
+			}
+			sha256_transform = savedTransform;
+			sha256_transform_id = savedId;
+		}
+	}
+	if (o.format == "json")
+		cout << "\n  ]\n}" << endl;
+	free(data);
+	return status;
+}
@@ -0,0 +1,268 @@
+#include <string>
+#include <mutex>
+#include <chrono>
+#include <unordered_map>
+#include <cstdio>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/file.h>
+#endif
+#include "sha256.h"
+using namespace std;
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+// Cache file layout, native byte order (device and inode numbers only mean something on this machine):
+//   header  magic "S2DC", version (4 bytes), record size (4 bytes), reserved (4 bytes)
+//   records appended one at a time, each
+//     0   device, inode, size (8 bytes each)
+//     24  mtime in nanoseconds (8 bytes)
+//     32  digest, big-endian bytes
+//     64  FNV-1a of bytes 0..63 (8 bytes), so a record torn by a crash is ignored
+// A later record for the same device and inode supersedes earlier ones.
+
+static const char CACHE_MAGIC[4] = {'S', '2', 'D', 'C'};
+const uint32_t CACHE_VERSION = 1;
+const int CACHE_HEADER = 16;
+const int CACHE_RECORD = 72;
+// Files modified this close to the start of the run are hashed but not cached: a second change
+// within the filesystem's timestamp granularity would otherwise leave size and mtime unchanged
+const int64_t CACHE_RACY_NS = 2000000000;
+
+struct CacheRecord
+{
+	uint64_t dev, ino, size;
+	int64_t mtime;
+	uint8_t digest[DIGEST_SIZE];
+	uint64_t check;
+};
+static_assert(sizeof(CacheRecord) == CACHE_RECORD, "CacheRecord must match the file layout");
+
+struct CacheKey
+{
+	uint64_t dev, ino;
+	bool operator==(const CacheKey &o) const { return dev == o.dev && ino == o.ino; }
+};
+
+struct CacheKeyHash
+{
+	size_t operator()(const CacheKey &k) const { return k.ino * 0x9e3779b97f4a7c15ull ^ k.dev; }
+};
+
+struct DigestCacheIndex
+{
+	mutex m;
+	unordered_map<CacheKey, CacheRecord, CacheKeyHash> records;
+	uint64_t fileRecords; // records in the file, superseded ones included
+	int64_t start;        // wall clock at open, in nanoseconds
+};
+
+static uint64_t record_check(const CacheRecord &r)
+{
+	const uint8_t *p = (const uint8_t *)&r;
+	uint64_t h = 0xcbf29ce484222325ull;
+	for (size_t i = 0; i < offsetof(CacheRecord, check); i++)
+		h = (h ^ p[i]) * 0x100000001b3ull;
+	return h;
+}
+
+static CacheRecord make_record(const struct stat &st, const uint32_t digest[8])
+{
+	CacheRecord r;
+	r.dev = st.st_dev;
+	r.ino = st.st_ino;
+	r.size = st.st_size;
+	r.mtime = stat_mtime_ns(st);
+	digest_bytes(digest, r.digest);
+	r.check = record_check(r);
+	return r;
+}
+
+static bool write_all(int fd, const void *data, size_t len)
+{
+	const uint8_t *p = (const uint8_t *)data;
+	while (len)
+	{
+		ssize_t n = write(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+static void write_header(uint8_t header[CACHE_HEADER])
+{
+	uint32_t fields[3] = {CACHE_VERSION, CACHE_RECORD, 0};
+	memcpy(header, CACHE_MAGIC, 4);
+	memcpy(header + 4, fields, sizeof(fields));
+}
+
+DigestCache::DigestCache() : hits(0), misses(0), stale(0), fd(-1), index(NULL) {}
+
+DigestCache::~DigestCache()
+{
+	close();
+}
+
+// Load every intact record; the file is mapped read-only for the scan and appended to with write()
+bool DigestCache::load()
+{
+	struct stat st;
+	if (fstat(fd, &st))
+		return false;
+	if (st.st_size == 0)
+	{
+		uint8_t header[CACHE_HEADER];
+		write_header(header);
+		return write_all(fd, header, CACHE_HEADER);
+	}
+	if (st.st_size < CACHE_HEADER)
+		return false;
+#ifndef _WIN32
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		return false;
+	const uint8_t *p = (const uint8_t *)map;
+#else
+	vector<uint8_t> buf(st.st_size);
+	if (lseek(fd, 0, SEEK_SET) || read(fd, buf.data(), buf.size()) != (ssize_t)buf.size())
+		return false;
+	const uint8_t *p = buf.data();
+#endif
+	uint8_t header[CACHE_HEADER];
+	write_header(header);
+	bool ok = !memcmp(p, header, CACHE_HEADER);
+	for (uint64_t off = CACHE_HEADER; ok && off + CACHE_RECORD <= (uint64_t)st.st_size; off += CACHE_RECORD)
+	{
+		CacheRecord r;
+		memcpy(&r, p + off, CACHE_RECORD);
+		index->fileRecords++;
+		if (r.check == record_check(r))
+			index->records[CacheKey{r.dev, r.ino}] = r;
+	}
+#ifndef _WIN32
+	munmap(map, st.st_size);
+#endif
+	// a torn last record is cut off, so the next append starts on a record boundary
+	uint64_t end = CACHE_HEADER + index->fileRecords * CACHE_RECORD;
+	if (ok && end != (uint64_t)st.st_size)
+		ok = ftruncate(fd, end) == 0;
+	return ok;
+}
+
+bool DigestCache::open(const char *file)
+{
+	close();
+	path = file;
+	index = new DigestCacheIndex;
+	index->fileRecords = 0;
+	index->start = chrono::duration_cast<chrono::nanoseconds>(chrono::system_clock::now().time_since_epoch()).count();
+	for (;;)
+	{
+		fd = ::open(file, O_RDWR | O_CREAT | O_APPEND | O_BINARY, 0644);
+		if (fd < 0)
+			break;
+#ifndef _WIN32
+		// one process at a time; after waiting, make sure the file was not replaced by a compaction
+		struct stat held, now;
+		if (flock(fd, LOCK_EX) || fstat(fd, &held))
+			break;
+		if (stat(file, &now) || now.st_ino != held.st_ino || now.st_dev != held.st_dev)
+		{
+			::close(fd);
+			continue;
+		}
+#endif
+		if (load())
+			return true;
+		errno = EINVAL;
+		break;
+	}
+	if (fd >= 0)
+		::close(fd);
+	fd = -1;
+	delete index;
+	index = NULL;
+	return false;
+}
+
+bool DigestCache::lookup(const struct stat &st, uint32_t digest[8])
+{
+	lock_guard<mutex> lock(index->m);
+	auto it = index->records.find(CacheKey{(uint64_t)st.st_dev, (uint64_t)st.st_ino});
+	if (it == index->records.end())
+	{
+		misses++;
+		return false;
+	}
+	const CacheRecord &r = it->second;
+	if (r.size != (uint64_t)st.st_size || r.mtime != stat_mtime_ns(st))
+	{
+		stale++;
+		return false;
+	}
+	for (int i = 0; i < 8; i++)
+		digest[i] = (r.digest[i * 4] << 24) | (r.digest[i * 4 + 1] << 16) | (r.digest[i * 4 + 2] << 8) | r.digest[i * 4 + 3];
+	hits++;
+	return true;
+}
+
+void DigestCache::store(const struct stat &st, const uint32_t digest[8])
+{
+	if (stat_mtime_ns(st) > index->start - CACHE_RACY_NS)
+		return;
+	CacheRecord r = make_record(st, digest);
+	lock_guard<mutex> lock(index->m);
+	if (write_all(fd, &r, CACHE_RECORD))
+	{
+		index->records[CacheKey{r.dev, r.ino}] = r;
+		index->fileRecords++;
+	}
+}
+
+// Rewrite the file with only the latest record per inode once superseded records make up most of it
+void DigestCache::compact()
+{
+	if (index->fileRecords < 1024 || index->fileRecords < 2 * index->records.size())
+		return;
+	string tmp = path + ".tmp";
+	int out = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+	if (out < 0)
+		return;
+	vector<uint8_t> buf(CACHE_HEADER + index->records.size() * CACHE_RECORD);
+	write_header(buf.data());
+	size_t off = CACHE_HEADER;
+	for (auto &e : index->records)
+	{
+		memcpy(&buf[off], &e.second, CACHE_RECORD);
+		off += CACHE_RECORD;
+	}
+	bool ok = write_all(out, buf.data(), buf.size());
+#ifndef _WIN32
+	ok = ok && fsync(out) == 0;
+#endif
+	ok = ::close(out) == 0 && ok;
+	if (!ok || rename(tmp.c_str(), path.c_str()))
+		unlink(tmp.c_str());
+}
+
+void DigestCache::close()
+{
+	if (fd < 0)
+		return;
+	compact();
+	::close(fd);
+	fd = -1;
+	delete index;
+	index = NULL;
+}
@@ -0,0 +1,240 @@
+#include <thread>
+#include <unistd.h>
+#include <fcntl.h>
+#include "sha256.h"
+using namespace std;
+
+// Content-defined chunking after FastCDC (Xia et al., USENIX ATC 2016): a Gear hash
+// fp = (fp << 1) + gear[byte] rolls over the input, and a chunk ends where the masked bits of fp
+// are all zero. The top bits of fp depend on the last 64 bytes only, so the masks take those.
+// Cut points are not searched before minSize, a stricter mask is used up to avgSize and a looser
+// one after it (normalized chunking), and a chunk is forced at maxSize.
+
+// 256 pseudo-random words from splitmix64; fixed, since the cut points and so the dedup ratio depend on them
+struct GearTable
+{
+	uint64_t g[256];
+	constexpr GearTable() : g()
+	{
+		uint64_t x = 0x5348413235364344ull;
+		for (int i = 0; i < 256; i++)
+		{
+			uint64_t z = (x += 0x9e3779b97f4a7c15ull);
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+			g[i] = z ^ (z >> 31);
+		}
+	}
+};
+static constexpr GearTable gear;
+
+static inline uint64_t top_bits(int n)
+{
+	return n <= 0 ? 0 : ~0ull << (64 - n);
+}
+
+bool cdc_valid(const CDCParams &p)
+{
+	return p.minSize >= 64 && p.minSize < p.avgSize && p.avgSize < p.maxSize && p.maxSize <= CDC_MAX_CHUNK &&
+		   !(p.avgSize & (p.avgSize - 1));
+}
+
+size_t cdc_cut(const uint8_t *data, size_t len, const CDCParams &p)
+{
+	if (len <= p.minSize)
+		return len;
+	int bits = __builtin_ctz(p.avgSize);
+	const uint64_t maskS = top_bits(bits + 2), maskL = top_bits(bits - 2);
+	size_t end = len < p.maxSize ? len : p.maxSize;
+	size_t normal = len < p.avgSize ? len : p.avgSize;
+	uint64_t fp = 0;
+	size_t i = p.minSize;
+	for (; i < normal; i++)
+	{
+		fp = (fp << 1) + gear.g[data[i]];
+		if (!(fp & maskS))
+			return i + 1;
+	}
+	for (; i < end; i++)
+	{
+		fp = (fp << 1) + gear.g[data[i]];
+		if (!(fp & maskL))
+			return i + 1;
+	}
+	return end;
+}
+
+// Three stages over a ring of slots, in stream order:
+//   chunker (own thread)    reads a slot full, cuts it into whole chunks, carries the unfinished tail to the next slot
+//   hashers (hashThreads)   each claims the next chunked slot and hashes all of its chunks with sha256_mb_hash
+//   indexer (calling thread) looks the chunks up in the index in order and frees the slot
+const int CDC_SLOTS = 8;
+const size_t CDC_SLOT_SIZE = 8 << 20;
+static_assert(CDC_SLOT_SIZE >= 2 * CDC_MAX_CHUNK, "a slot must hold a carried tail plus a whole chunk");
+
+enum SlotState
+{
+	SLOT_FREE,
+	SLOT_CHUNKED,
+	SLOT_HASHING,
+	SLOT_HASHED,
+};
+
+struct CDCSlot
+{
+	uint8_t *data;
+	size_t len;               // bytes of whole chunks
+	uint64_t offset;          // stream offset of data[0]
+	vector<uint32_t> ends;    // end of each chunk in data
+	vector<uint32_t> digests; // 8 words per chunk
+	SlotState state;
+	bool last;
+};
+
+struct CDCRing : SlotRing<CDCSlot, CDC_SLOTS>
+{
+	uint64_t nextHash = 0; // sequence number of the next slot a hasher claims
+	bool done = false;     // the chunker has published its last slot
+};
+
+static void chunker(int fd, const CDCParams &params, CDCRing &ring, DedupStats &stats)
+{
+	vector<uint8_t> carry;
+	uint64_t offset = 0;
+	for (uint64_t seq = 0;; seq++)
+	{
+		CDCSlot &s = ring.slot[seq % CDC_SLOTS];
+		ring.wait([&]
+				  { return s.state == SLOT_FREE; });
+
+		auto t = chrono::steady_clock::now();
+		memcpy(s.data, carry.data(), carry.size());
+		bool eof, error;
+		size_t len = carry.size() + read_fill(fd, s.data + carry.size(), CDC_SLOT_SIZE - carry.size(), eof, error);
+		stats.read += seconds_since(t);
+
+		// cut while a whole maximum-size chunk is available; at the end of the input cut everything
+		t = chrono::steady_clock::now();
+		s.ends.clear();
+		size_t pos = 0;
+		while (pos < len && (eof || len - pos >= CDC_MAX_CHUNK))
+		{
+			pos += cdc_cut(s.data + pos, len - pos, params);
+			s.ends.push_back(pos);
+		}
+		carry.assign(s.data + pos, s.data + len);
+		s.len = pos;
+		s.offset = offset;
+		offset += pos;
+		stats.chunk += seconds_since(t);
+
+		ring.publish([&]
+					 {
+			s.state = SLOT_CHUNKED;
+			s.last = eof;
+			ring.error = ring.error || error;
+			ring.done = eof; });
+		if (eof)
+			return;
+	}
+}
+
+static void hasher(CDCRing &ring, double &busy)
+{
+	for (;;)
+	{
+		CDCSlot *s;
+		{
+			auto lock = ring.wait([&]
+								  { return ring.slot[ring.nextHash % CDC_SLOTS].state == SLOT_CHUNKED || ring.done; });
+			s = &ring.slot[ring.nextHash % CDC_SLOTS];
+			if (s->state != SLOT_CHUNKED)
+				return;
+			s->state = SLOT_HASHING;
+			ring.nextHash++;
+		}
+
+		auto t = chrono::steady_clock::now();
+		size_t n = s->ends.size();
+		vector<const uint8_t *> msgs(n);
+		vector<uint64_t> lens(n);
+		for (size_t i = 0, start = 0; i < n; start = s->ends[i++])
+		{
+			msgs[i] = s->data + start;
+			lens[i] = s->ends[i] - start;
+		}
+		s->digests.resize(8 * n);
+		sha256_mb_hash(msgs.data(), lens.data(), (uint32_t (*)[8])s->digests.data(), n);
+		busy += seconds_since(t);
+
+		ring.publish([&]
+					 { s->state = SLOT_HASHED; });
+	}
+}
+
+bool sha256_dedup_fd(int fd, const CDCParams &params, int hashThreads, ChunkIndex &index, DedupStats *stats,
+					 const function<void(const CDCChunk &)> &onChunk)
+{
+	if (!cdc_valid(params))
+		return false;
+	if (hashThreads <= 0)
+		hashThreads = max(1, (int)thread::hardware_concurrency() - 2);
+	CDCRing ring;
+	DedupStats st = {};
+	if (!ring.alloc(CDC_SLOT_SIZE))
+		return false;
+#ifdef POSIX_FADV_SEQUENTIAL
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	auto total = chrono::steady_clock::now();
+	vector<double> hashBusy(hashThreads);
+	thread reader(chunker, fd, cref(params), ref(ring), ref(st));
+	vector<thread> hashers;
+	for (int i = 0; i < hashThreads; i++)
+		hashers.emplace_back(hasher, ref(ring), ref(hashBusy[i]));
+
+	for (uint64_t seq = 0;; seq++)
+	{
+		CDCSlot &s = ring.slot[seq % CDC_SLOTS];
+		ring.wait([&]
+				  { return s.state == SLOT_HASHED; });
+
+		auto t = chrono::steady_clock::now();
+		CDCChunk c;
+		for (size_t i = 0, start = 0; i < s.ends.size(); start = s.ends[i++])
+		{
+			c.offset = s.offset + start;
+			c.length = s.ends[i] - start;
+			memcpy(c.digest, &s.digests[8 * i], sizeof(c.digest));
+			ChunkIndex::Key key;
+			memcpy(key.d, c.digest, sizeof(key.d));
+			c.duplicate = !index.chunks.emplace(key, c.length).second;
+			st.chunks++;
+			st.bytes += c.length;
+			if (!c.duplicate)
+			{
+				st.uniqueChunks++;
+				st.uniqueBytes += c.length;
+			}
+			if (onChunk)
+				onChunk(c);
+		}
+		st.index += seconds_since(t);
+
+		bool last = s.last;
+		ring.publish([&]
+					 { s.state = SLOT_FREE; });
+		if (last)
+			break;
+	}
+	reader.join();
+	for (auto &th : hashers)
+		th.join();
+	st.total = seconds_since(total);
+	for (double h : hashBusy)
+		st.hash += h;
+	if (stats)
+		*stats = st;
+	return !ring.error;
+}
@@ -0,0 +1,235 @@
+#include <iostream>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "sha256.h"
+using namespace std;
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+// Checkpoint layout, all integers little-endian:
+//   0       magic "S2CK"
+//   4       version, SHA256_CHECKPOINT_VERSION
+//   5       n = totalBytes % BLOCK_SIZE, the buffered bytes
+//   6       reserved, 0 (2 bytes)
+//   8       totalBytes (8 bytes), also the input offset to resume from
+//   16      state (8 x 4 bytes)
+//   48      input size, mtime in nanoseconds, device, inode (8 bytes each; all 0 for pipes)
+//   80      the n buffered bytes
+//   80 + n  the first 8 bytes of the SHA-256 of bytes 0 .. 80 + n, so torn or foreign files are rejected
+
+static const char CHECKPOINT_MAGIC[4] = {'S', '2', 'C', 'K'};
+const int CHECKPOINT_SOURCE = 48;
+const int CHECKPOINT_HEADER = 80;
+const int CHECKPOINT_CHECK = 8;
+
+static void put_le(uint8_t *p, uint64_t v, int bytes)
+{
+	for (int i = 0; i < bytes; i++)
+		p[i] = v >> (i * 8);
+}
+
+static uint64_t get_le(const uint8_t *p, int bytes)
+{
+	uint64_t v = 0;
+	for (int i = bytes - 1; i >= 0; i--)
+		v = (v << 8) | p[i];
+	return v;
+}
+
+static void checkpoint_check(const uint8_t *data, size_t len, uint8_t check[CHECKPOINT_CHECK])
+{
+	SHA256 sha256;
+	sha256.update(data, len);
+	sha256.final();
+	uint8_t digest[DIGEST_SIZE];
+	digest_bytes(sha256.state, digest);
+	memcpy(check, digest, CHECKPOINT_CHECK);
+}
+
+bool checkpoint_source(int fd, CheckpointSource &src)
+{
+	struct stat st;
+	src = CheckpointSource();
+	if (fstat(fd, &st))
+		return false;
+	if (S_ISREG(st.st_mode))
+	{
+		src.size = st.st_size;
+		src.dev = st.st_dev;
+		src.ino = st.st_ino;
+		src.mtime = stat_mtime_ns(st);
+	}
+	return true;
+}
+
+size_t sha256_checkpoint_save(const SHA256 &ctx, const CheckpointSource &src, uint8_t out[SHA256_CHECKPOINT_MAX])
+{
+	int used = ctx.totalBytes % BLOCK_SIZE;
+	memcpy(out, CHECKPOINT_MAGIC, 4);
+	out[4] = SHA256_CHECKPOINT_VERSION;
+	out[5] = used;
+	put_le(out + 6, 0, 2);
+	put_le(out + 8, ctx.totalBytes, 8);
+	for (int i = 0; i < 8; i++)
+		put_le(out + 16 + i * 4, ctx.state[i], 4);
+	put_le(out + CHECKPOINT_SOURCE, src.size, 8);
+	put_le(out + CHECKPOINT_SOURCE + 8, src.mtime, 8);
+	put_le(out + CHECKPOINT_SOURCE + 16, src.dev, 8);
+	put_le(out + CHECKPOINT_SOURCE + 24, src.ino, 8);
+	memcpy(out + CHECKPOINT_HEADER, ctx.buffer, used);
+	checkpoint_check(out, CHECKPOINT_HEADER + used, out + CHECKPOINT_HEADER + used);
+	return CHECKPOINT_HEADER + used + CHECKPOINT_CHECK;
+}
+
+bool sha256_checkpoint_load(SHA256 &ctx, CheckpointSource &src, const uint8_t *in, size_t len)
+{
+	if (len < CHECKPOINT_HEADER + CHECKPOINT_CHECK || memcmp(in, CHECKPOINT_MAGIC, 4) || in[4] != SHA256_CHECKPOINT_VERSION)
+		return false;
+	int used = in[5];
+	uint64_t total = get_le(in + 8, 8);
+	if (used != (int)(total % BLOCK_SIZE) || get_le(in + 6, 2) || len != (size_t)CHECKPOINT_HEADER + used + CHECKPOINT_CHECK)
+		return false;
+	uint8_t check[CHECKPOINT_CHECK];
+	checkpoint_check(in, CHECKPOINT_HEADER + used, check);
+	if (memcmp(check, in + CHECKPOINT_HEADER + used, CHECKPOINT_CHECK))
+		return false;
+
+	ctx.totalBytes = total;
+	for (int i = 0; i < 8; i++)
+		ctx.state[i] = get_le(in + 16 + i * 4, 4);
+	src.size = get_le(in + CHECKPOINT_SOURCE, 8);
+	src.mtime = get_le(in + CHECKPOINT_SOURCE + 8, 8);
+	src.dev = get_le(in + CHECKPOINT_SOURCE + 16, 8);
+	src.ino = get_le(in + CHECKPOINT_SOURCE + 24, 8);
+	memcpy(ctx.buffer, in + CHECKPOINT_HEADER, used);
+	return true;
+}
+
+// Written to path.tmp, synced and renamed over path, so a crash leaves either the old or the new checkpoint
+bool sha256_checkpoint_write(const SHA256 &ctx, const CheckpointSource &src, const char *path)
+{
+	uint8_t buf[SHA256_CHECKPOINT_MAX];
+	size_t len = sha256_checkpoint_save(ctx, src, buf);
+	string tmp = string(path) + ".tmp";
+	int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+	if (fd < 0)
+		return false;
+	bool ok = write(fd, buf, len) == (ssize_t)len;
+#ifndef _WIN32
+	ok = ok && fsync(fd) == 0;
+#endif
+	ok = close(fd) == 0 && ok;
+	if (ok && rename(tmp.c_str(), path) == 0)
+		return true;
+	unlink(tmp.c_str());
+	return false;
+}
+
+// Returns 1 if a valid checkpoint was read, 0 if there is none, -1 if the file is not a valid checkpoint
+int sha256_checkpoint_read(SHA256 &ctx, CheckpointSource &src, const char *path)
+{
+	int fd = open(path, O_RDONLY | O_BINARY);
+	if (fd < 0)
+		return errno == ENOENT ? 0 : -1;
+	uint8_t buf[SHA256_CHECKPOINT_MAX + 1];
+	ssize_t len = read(fd, buf, sizeof(buf));
+	close(fd);
+	return len > 0 && sha256_checkpoint_load(ctx, src, buf, len) ? 1 : -1;
+}
+
+// Skip to the checkpointed offset: seek within a regular file, otherwise read and discard until
+// exactly offset bytes have gone by (a seek past EOF would succeed, a short input must not)
+static bool skip_to(int fd, uint64_t offset, const CheckpointSource &src, uint8_t *buf, size_t size)
+{
+	if (offset == 0)
+		return true;
+	if (src.ino || src.dev)
+		return offset <= src.size && lseek(fd, offset, SEEK_SET) == (off_t)offset;
+	while (offset)
+	{
+		ssize_t got = read(fd, buf, offset < size ? offset : size);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got <= 0)
+			return false;
+		offset -= got;
+	}
+	return true;
+}
+
+bool sha256_fd_resumable(int fd, const char *path, uint64_t interval, uint32_t digest[8])
+{
+	const size_t BUFFER = 1 << 20;
+	SHA256 sha256;
+	CheckpointSource src, saved;
+	if (!checkpoint_source(fd, src))
+		return false;
+	int found = sha256_checkpoint_read(sha256, saved, path);
+	// path may be some other file given by mistake: only a checkpoint this code wrote is replaced or removed
+	if (found < 0)
+	{
+		cerr << path << ": not a valid checkpoint, leaving it alone" << endl;
+		errno = EINVAL;
+		return false;
+	}
+	else if (found && !(saved == src))
+	{
+		cerr << path << ": checkpoint belongs to a different or modified input" << endl;
+		errno = EINVAL;
+		return false;
+	}
+	else if (found)
+		cerr << path << ": resuming at byte " << sha256.totalBytes << endl;
+
+	uint8_t *buf;
+	if (posix_memalign((void **)&buf, 4096, BUFFER))
+		return false;
+	bool ok = skip_to(fd, sha256.totalBytes, src, buf, BUFFER);
+	if (!ok)
+	{
+		cerr << path << ": input ends before the checkpointed offset " << sha256.totalBytes << endl;
+		errno = EINVAL;
+	}
+#ifdef POSIX_FADV_SEQUENTIAL
+	posix_fadvise(fd, sha256.totalBytes, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	uint64_t next = interval ? (sha256.totalBytes / interval + 1) * interval : UINT64_MAX;
+	bool owned = found > 0; // path holds a checkpoint of this input
+	while (ok)
+	{
+		// never read past the next checkpoint, so checkpoints land exactly on multiples of interval
+		size_t want = min<uint64_t>(BUFFER, next - sha256.totalBytes);
+		ssize_t got = read(fd, buf, want);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got <= 0)
+		{
+			ok = got == 0;
+			break;
+		}
+		sha256.update(buf, got);
+		if (sha256.totalBytes == next)
+		{
+			if (sha256_checkpoint_write(sha256, src, path))
+				owned = true;
+			else
+				cerr << path << ": cannot write checkpoint" << endl;
+			next += interval;
+		}
+	}
+	free(buf);
+	if (!ok)
+		return false;
+	sha256.final();
+	memcpy(digest, sha256.state, sizeof(sha256.state));
+	if (owned)
+		unlink(path);
+	return true;
+}
@@ -0,0 +1,371 @@
+#include <iostream>
+#include <string>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#else
+#define lstat stat
+#endif
+#include "sha256.h"
+using namespace std;
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+// Files below SMALL_FILE are read whole and hashed BATCH_FILES at a time on the multi-buffer
+// backend; larger ones are streamed SEGMENT bytes per task, so a big file never pins a worker
+// for long and the tasks around it can be stolen by idle workers.
+const uint64_t SMALL_FILE = 64 << 10;
+const size_t BATCH_FILES = 64;
+const uint64_t SEGMENT = 16 << 20;
+
+// Each worker owns a deque: it pushes and pops at the back (depth first, so directories are
+// finished before the walk fans out further), idle workers steal from the front of the others.
+// A worker that finds nothing to take sleeps until a task is pushed or the last task finishes.
+class WorkStealingPool
+{
+public:
+	typedef function<void(int)> Task; // the argument is the index of the worker running the task
+
+	WorkStealingPool(int threads) : queues(threads), pending(0), queued(0) {}
+
+	void push(int worker, Task task)
+	{
+		pending++;
+		{
+			lock_guard<mutex> lock(queues[worker].m);
+			queues[worker].tasks.push_back(move(task));
+		}
+		queued++;
+		// taking the lock orders this after a sleeper's check of queued, so the wakeup cannot be lost
+		lock_guard<mutex> lock(idleMutex);
+		idle.notify_one();
+	}
+
+	// Run until every task, including the ones pushed by running tasks, has finished
+	void run()
+	{
+		vector<thread> pool;
+		for (size_t w = 1; w < queues.size(); w++)
+			pool.emplace_back(&WorkStealingPool::work, this, w);
+		work(0);
+		for (auto &th : pool)
+			th.join();
+	}
+
+private:
+	struct Queue
+	{
+		mutex m;
+		deque<Task> tasks;
+	};
+	vector<Queue> queues;
+	atomic<size_t> pending; // pushed and not yet finished; a task pushes its children before it counts as finished
+	atomic<size_t> queued;  // in a deque, not yet taken
+	mutex idleMutex;
+	condition_variable idle; // signalled by push() and when pending drops to 0
+
+	bool pop(int worker, Task &task)
+	{
+		int n = queues.size();
+		for (int i = 0; i < n; i++)
+		{
+			Queue &q = queues[(worker + i) % n];
+			lock_guard<mutex> lock(q.m);
+			if (q.tasks.empty())
+				continue;
+			if (i == 0)
+			{
+				task = move(q.tasks.back());
+				q.tasks.pop_back();
+			}
+			else
+			{
+				task = move(q.tasks.front());
+				q.tasks.pop_front();
+			}
+			queued--;
+			return true;
+		}
+		return false;
+	}
+
+	void work(int worker)
+	{
+		Task task;
+		for (;;)
+		{
+			if (pop(worker, task))
+			{
+				task(worker);
+				task = nullptr;
+				if (--pending == 0)
+				{
+					lock_guard<mutex> lock(idleMutex);
+					idle.notify_all();
+				}
+				continue;
+			}
+			unique_lock<mutex> lock(idleMutex);
+			idle.wait(lock, [&]
+					  { return queued > 0 || pending == 0; });
+			if (pending == 0)
+				return;
+		}
+	}
+};
+
+struct DirWalk
+{
+	WorkStealingPool pool;
+	vector<vector<ManifestEntry>> results; // one list per worker, merged at the end
+	atomic<bool> ok;
+	DigestCache *cache;
+
+	DirWalk(int threads, DigestCache *cache) : pool(threads), results(threads), ok(true), cache(cache) {}
+
+	void fail(const string &path)
+	{
+		perror(path.c_str());
+		ok = false;
+	}
+
+	void add(int worker, const string &path, const uint32_t digest[8])
+	{
+		results[worker].emplace_back();
+		results[worker].back().path = path;
+		memcpy(results[worker].back().digest, digest, sizeof(results[worker].back().digest));
+	}
+
+	void directory(int worker, const string &path);
+	void small_files(int worker, const vector<pair<string, struct stat>> &files);
+	void large_file(int worker, const string &path);
+};
+
+struct LargeFile
+{
+	string path;
+	struct stat st;
+	int fd;
+	uint64_t size;
+	uint64_t offset;
+	SHA256 sha256;
+
+	~LargeFile()
+	{
+		if (fd >= 0)
+			close(fd);
+	}
+};
+
+// Hash one segment of a large file and push the rest as a new task: the context travels with it,
+// so consecutive segments may run on different workers
+static void large_segment(DirWalk &walk, int worker, shared_ptr<LargeFile> f)
+{
+	uint64_t len = min(SEGMENT, f->size - f->offset);
+	if (len)
+	{
+#ifndef _WIN32
+		void *p = mmap(NULL, len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, f->fd, f->offset);
+		if (p == MAP_FAILED)
+		{
+			walk.fail(f->path);
+			return;
+		}
+		f->sha256.update((const uint8_t *)p, len);
+		munmap(p, len);
+#else
+		vector<uint8_t> buf(len);
+		if (lseek(f->fd, f->offset, SEEK_SET) != (off_t)f->offset || read(f->fd, buf.data(), len) != (ssize_t)len)
+		{
+			walk.fail(f->path);
+			return;
+		}
+		f->sha256.update(buf.data(), len);
+#endif
+		f->offset += len;
+	}
+	if (f->offset < f->size)
+	{
+		walk.pool.push(worker, [&walk, f](int w)
+					   { large_segment(walk, w, f); });
+		return;
+	}
+	f->sha256.final();
+	if (walk.cache)
+		walk.cache->store(f->st, f->sha256.state);
+	walk.add(worker, f->path, f->sha256.state);
+}
+
+void DirWalk::large_file(int worker, const string &path)
+{
+	shared_ptr<LargeFile> f(new LargeFile);
+	f->path = path;
+	f->offset = 0;
+	f->fd = open(path.c_str(), O_RDONLY | O_BINARY);
+	if (f->fd < 0 || fstat(f->fd, &f->st))
+	{
+		fail(path);
+		return;
+	}
+	uint32_t digest[8];
+	if (cache && S_ISREG(f->st.st_mode) && cache->lookup(f->st, digest))
+	{
+		add(worker, path, digest);
+		return;
+	}
+	// the size at open time is what gets hashed; a file that grows meanwhile is not chased
+	f->size = f->st.st_size;
+	large_segment(*this, worker, f);
+}
+
+static bool read_all(const string &path, vector<uint8_t> &out)
+{
+	int fd = open(path.c_str(), O_RDONLY | O_BINARY);
+	if (fd < 0)
+		return false;
+	size_t used = out.size();
+	ssize_t got;
+	do
+	{
+		if (out.size() - used < SMALL_FILE)
+			out.resize(used + SMALL_FILE);
+		got = read(fd, out.data() + used, out.size() - used);
+		if (got > 0)
+			used += got;
+	} while (got > 0 || (got < 0 && errno == EINTR));
+	close(fd);
+	out.resize(used);
+	return got == 0;
+}
+
+// The stat of each file is the one from the directory listing, taken before the file is read, so a
+// cache record can only describe older contents than the digest stored with it, never newer
+void DirWalk::small_files(int worker, const vector<pair<string, struct stat>> &files)
+{
+	vector<uint8_t> data;
+	vector<uint64_t> offsets, lens;
+	vector<size_t> index; // into files, for the ones that could be read
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		size_t start = data.size();
+		if (!read_all(files[i].first, data))
+		{
+			fail(files[i].first);
+			data.resize(start);
+			continue;
+		}
+		offsets.push_back(start);
+		lens.push_back(data.size() - start);
+		index.push_back(i);
+	}
+	// the messages are only addressed once data has stopped growing
+	vector<const uint8_t *> msgs(index.size());
+	for (size_t i = 0; i < index.size(); i++)
+		msgs[i] = data.data() + offsets[i];
+	vector<uint32_t> digests(8 * index.size());
+	sha256_mb_hash(msgs.data(), lens.data(), (uint32_t (*)[8])digests.data(), index.size());
+	for (size_t i = 0; i < index.size(); i++)
+	{
+		if (cache)
+			cache->store(files[index[i]].second, &digests[8 * i]);
+		add(worker, files[index[i]].first, &digests[8 * i]);
+	}
+}
+
+// List one directory: subdirectories become tasks of their own, small files are gathered into
+// batches and large files start streaming. Symlinks and special files are skipped, like find -type f.
+void DirWalk::directory(int worker, const string &path)
+{
+	DIR *dir = opendir(path.c_str());
+	if (!dir)
+	{
+		fail(path);
+		return;
+	}
+	string prefix = path == "/" ? path : path + "/";
+	vector<pair<string, struct stat>> batch;
+	for (struct dirent *e; (e = readdir(dir));)
+	{
+		if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, ".."))
+			continue;
+		string child = prefix + e->d_name;
+		struct stat st;
+		if (lstat(child.c_str(), &st))
+		{
+			fail(child);
+			continue;
+		}
+		if (S_ISDIR(st.st_mode))
+			pool.push(worker, [this, child](int w)
+					  { directory(w, child); });
+		else if (S_ISREG(st.st_mode) && (uint64_t)st.st_size >= SMALL_FILE)
+			pool.push(worker, [this, child](int w)
+					  { large_file(w, child); });
+		else if (S_ISREG(st.st_mode))
+		{
+			uint32_t digest[8];
+			if (cache && cache->lookup(st, digest))
+			{
+				add(worker, child, digest);
+				continue;
+			}
+			batch.emplace_back(child, st);
+			if (batch.size() == BATCH_FILES)
+			{
+				pool.push(worker, [this, batch](int w)
+						  { small_files(w, batch); });
+				batch.clear();
+			}
+		}
+	}
+	closedir(dir);
+	if (!batch.empty())
+		small_files(worker, batch);
+}
+
+bool sha256_dir(const char *root, int threads, DigestCache *cache, vector<ManifestEntry> &manifest)
+{
+	if (threads <= 0)
+		threads = thread::hardware_concurrency();
+	if (threads <= 0)
+		threads = 1;
+	string path = root;
+	while (path.size() > 1 && path.back() == '/')
+		path.pop_back();
+
+	DirWalk walk(threads, cache);
+	struct stat st;
+	if (stat(path.c_str(), &st))
+	{
+		walk.fail(path);
+		return false;
+	}
+	if (S_ISDIR(st.st_mode))
+		walk.pool.push(0, [&walk, path](int w)
+					   { walk.directory(w, path); });
+	else
+		walk.pool.push(0, [&walk, path](int w)
+					   { walk.large_file(w, path); });
+	walk.pool.run();
+
+	for (auto &r : walk.results)
+		manifest.insert(manifest.end(), r.begin(), r.end());
+	sort(manifest.begin(), manifest.end(), [](const ManifestEntry &a, const ManifestEntry &b)
+		 { return a.path < b.path; });
+	return walk.ok;
+}
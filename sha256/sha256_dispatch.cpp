@@ -0,0 +1,292 @@
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include "sha256.h"
+#include "sha512.h"
+using namespace std;
+
+// CPUID probes
+
+int CheckForIntelShaExtensions()
+{
+	int a, b, c, d;
+
+	// Look for CPUID.7.0.EBX[29]
+	// EAX = 7, ECX = 0
+	a = 7;
+	c = 0;
+
+	asm volatile("cpuid"
+				 : "=a"(a), "=b"(b), "=c"(c), "=d"(d)
+				 : "a"(a), "c"(c));
+
+	// Intel® SHA Extensions feature bit is EBX[29]
+	return ((b >> 29) & 1);
+}
+
+// The OS must save the extended registers: CPUID.1.ECX[27] (OSXSAVE) and the XCR0 bits in mask
+static int CheckXCR0(uint32_t mask)
+{
+	int a, b, c, d;
+	a = 1;
+	asm volatile("cpuid"
+				 : "=a"(a), "=b"(b), "=c"(c), "=d"(d)
+				 : "a"(a));
+	if (!((c >> 27) & 1))
+		return 0;
+	asm volatile("xgetbv"
+				 : "=a"(a), "=d"(d)
+				 : "c"(0));
+	return (a & mask) == mask;
+}
+
+int CheckForSSSE3()
+{
+	int a, b, c, d;
+
+	// SSSE3 feature bit is CPUID.1.ECX[9]
+	a = 1;
+	asm volatile("cpuid"
+				 : "=a"(a), "=b"(b), "=c"(c), "=d"(d)
+				 : "a"(a));
+	return ((c >> 9) & 1);
+}
+
+int CheckForAVX()
+{
+	int a, b, c, d;
+	if (!CheckXCR0(0x6)) // XMM, YMM
+		return 0;
+
+	// AVX feature bit is CPUID.1.ECX[28]
+	a = 1;
+	asm volatile("cpuid"
+				 : "=a"(a), "=b"(b), "=c"(c), "=d"(d)
+				 : "a"(a));
+	return ((c >> 28) & 1);
+}
+
+int CheckForAVX2()
+{
+	int a, b, c, d;
+	if (!CheckXCR0(0x6)) // XMM, YMM
+		return 0;
+
+	// AVX2 feature bit is CPUID.7.0.EBX[5]
+	a = 7;
+	c = 0;
+	asm volatile("cpuid"
+				 : "=a"(a), "=b"(b), "=c"(c), "=d"(d)
+				 : "a"(a), "c"(c));
+	return ((b >> 5) & 1);
+}
+
+int CheckForAVX512()
+{
+	int a, b, c, d;
+	if (!CheckXCR0(0xE6)) // XMM, YMM, opmask, ZMM0-15, ZMM16-31
+		return 0;
+
+	// AVX-512F feature bit is CPUID.7.0.EBX[16]
+	a = 7;
+	c = 0;
+	asm volatile("cpuid"
+				 : "=a"(a), "=b"(b), "=c"(c), "=d"(d)
+				 : "a"(a), "c"(c));
+	return ((b >> 16) & 1);
+}
+
+// Backends
+
+void sha256_generic_transform(uint32_t *state, const void *data, uint32_t numBlocks)
+{
+	const uint8_t *block = (const uint8_t *)data;
+	for (uint32_t i = 0; i < numBlocks; i++, block += BLOCK_SIZE)
+		sha256_compress(state, block);
+}
+
+// Multi-buffer fallback: hash the messages one after another with the single-stream transform
+void sha256_mb_serial(const uint8_t *const *msgs, const uint64_t *lens, uint32_t (*digests)[8], size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		SHA256 sha256;
+		sha256.update(msgs[i], lens[i]);
+		sha256.final();
+		memcpy(digests[i], sha256.state, sizeof(sha256.state));
+	}
+}
+
+struct TransformBackend
+{
+	int id;
+	const char *name;
+	sha256_transform_fn fn;
+	int (*supported)();
+};
+
+struct MBBackend
+{
+	const char *name;
+	sha256_mb_fn fn;
+	int (*supported)();
+};
+
+struct Transform512Backend
+{
+	const char *name;
+	sha512_transform_fn fn;
+	int (*supported)();
+};
+
+struct MB512Backend
+{
+	const char *name;
+	sha512_mb_fn fn;
+	int (*supported)();
+};
+
+static int Always() { return 1; }
+
+// Fastest first
+static const TransformBackend transform_backends[] = {
+	{TRANSFORM_SHA_NI, "sha_ni", sha256_ni_blocks, CheckForIntelShaExtensions},
+	{TRANSFORM_AVX2, "avx2", sha256_avx2_transform, CheckForAVX2},
+	{TRANSFORM_AVX, "avx", sha256_avx_transform, CheckForAVX},
+	{TRANSFORM_SSSE3, "ssse3", sha256_ssse3_transform, CheckForSSSE3},
+	{TRANSFORM_GENERIC, "generic", sha256_generic_transform, Always},
+};
+
+static const MBBackend mb_backends[] = {
+	{"avx512", sha256_mb_avx512, CheckForAVX512},
+	// looping the SHA-NI transform beats the 2-way interleave on messages under 256 bytes;
+	// sha_ni stays selectable for long ones
+	{"serial", sha256_mb_serial, CheckForIntelShaExtensions},
+	{"sha_ni", sha256_mb_sha_ni, CheckForIntelShaExtensions},
+	{"avx2", sha256_mb_avx2, CheckForAVX2},
+	{"serial", sha256_mb_serial, Always},
+};
+
+static const Transform512Backend transform512_backends[] = {
+	{"avx2", sha512_avx2_transform, CheckForAVX2},
+	{"generic", sha512_generic_transform, Always},
+};
+
+static const MB512Backend mb512_backends[] = {
+	{"avx2", sha512_mb_avx2, CheckForAVX2},
+	{"serial", sha512_mb_serial, Always},
+};
+
+CPUFeatures cpu_features;
+
+int sha256_batch_lanes()
+{
+	sha256_dispatch_init();
+	if (!strcmp(sha256_mb_name, "avx512"))
+		return MB_LANES_AVX512;
+	if (!strcmp(sha256_transform_name, "sha_ni"))
+		return 1;
+	if (!strcmp(sha256_mb_name, "avx2"))
+		return MB_LANES_AVX2;
+	return 0;
+}
+
+static void resolve_transform(uint32_t *state, const void *data, uint32_t numBlocks);
+static void resolve_mb(const uint8_t *const *msgs, const uint64_t *lens, uint32_t (*digests)[8], size_t count);
+static void resolve_transform512(uint64_t *state, const void *data, uint32_t numBlocks);
+static void resolve_mb512(const uint64_t iv[8], const uint8_t *const *msgs, const uint64_t *lens, uint64_t (*digests)[8], size_t count);
+
+// All pointers start at a resolver, so the first call (even from a static constructor) probes the CPU
+sha256_transform_fn sha256_transform = resolve_transform;
+sha256_mb_fn sha256_mb_hash = resolve_mb;
+int sha256_transform_id = TRANSFORM_UNRESOLVED;
+const char *sha256_transform_name = "unresolved";
+const char *sha256_mb_name = "unresolved";
+sha512_transform_fn sha512_transform = resolve_transform512;
+sha512_mb_fn sha512_mb_hash = resolve_mb512;
+const char *sha512_transform_name = "unresolved";
+const char *sha512_mb_name = "unresolved";
+
+// Pick the first supported backend, or the one named by the environment variable if it is supported
+template <typename Backend, int N>
+static const Backend &select_backend(const Backend (&backends)[N], const char *env)
+{
+	const char *forced = getenv(env);
+	if (forced)
+	{
+		// a name may be listed more than once at different ranks
+		bool known = false;
+		for (int i = 0; i < N; i++)
+			if (!strcmp(forced, backends[i].name))
+			{
+				if (backends[i].supported())
+					return backends[i];
+				known = true;
+			}
+		if (known)
+			cerr << env << "=" << forced << " is not supported by this CPU, ignored" << endl;
+		else
+			cerr << env << "=" << forced << " is not a known backend, ignored" << endl;
+	}
+	for (int i = 0; i < N; i++)
+		if (backends[i].supported())
+			return backends[i];
+	return backends[N - 1];
+}
+
+// Probe the CPU and fill in every pointer; runs exactly once, from sha256_dispatch_init()
+static void dispatch_probe()
+{
+	cpu_features.ssse3 = CheckForSSSE3();
+	cpu_features.avx = CheckForAVX();
+	cpu_features.avx2 = CheckForAVX2();
+	cpu_features.avx512 = CheckForAVX512();
+	cpu_features.sha_ni = CheckForIntelShaExtensions();
+
+	const TransformBackend &t = select_backend(transform_backends, "SHA256_BACKEND");
+	sha256_transform = t.fn;
+	sha256_transform_id = t.id;
+	sha256_transform_name = t.name;
+	const MBBackend &m = select_backend(mb_backends, "SHA256_MB_BACKEND");
+	sha256_mb_hash = m.fn;
+	sha256_mb_name = m.name;
+
+	const Transform512Backend &t512 = select_backend(transform512_backends, "SHA512_BACKEND");
+	sha512_transform = t512.fn;
+	sha512_transform_name = t512.name;
+	const MB512Backend &m512 = select_backend(mb512_backends, "SHA512_MB_BACKEND");
+	sha512_mb_hash = m512.fn;
+	sha512_mb_name = m512.name;
+}
+
+// Threads that arrive while another one is probing wait until the whole table is filled in
+void sha256_dispatch_init()
+{
+	static once_flag once;
+	call_once(once, dispatch_probe);
+}
+
+static void resolve_transform(uint32_t *state, const void *data, uint32_t numBlocks)
+{
+	sha256_dispatch_init();
+	sha256_transform(state, data, numBlocks);
+}
+
+static void resolve_mb(const uint8_t *const *msgs, const uint64_t *lens, uint32_t (*digests)[8], size_t count)
+{
+	sha256_dispatch_init();
+	sha256_mb_hash(msgs, lens, digests, count);
+}
+
+static void resolve_transform512(uint64_t *state, const void *data, uint32_t numBlocks)
+{
+	sha256_dispatch_init();
+	sha512_transform(state, data, numBlocks);
+}
+
+static void resolve_mb512(const uint64_t iv[8], const uint8_t *const *msgs, const uint64_t *lens, uint64_t (*digests)[8], size_t count)
+{
+	sha256_dispatch_init();
+	sha512_mb_hash(iv, msgs, lens, digests, count);
+}
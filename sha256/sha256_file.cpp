@@ -0,0 +1,385 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+#include "sha256.h"
+using namespace std;
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+// Regular files are mapped one window at a time, so resident memory stays bounded
+// however large the file is; everything else (pipes, terminals) is read into an aligned buffer.
+const uint64_t MAP_WINDOW = 16 << 20;
+const size_t READ_BUFFER = 1 << 20;
+
+static bool sha256_read(int fd, SHA256 &sha256)
+{
+	uint8_t *buf;
+	if (posix_memalign((void **)&buf, 4096, READ_BUFFER))
+		return false;
+	ssize_t got;
+	while ((got = read(fd, buf, READ_BUFFER)) != 0)
+	{
+		if (got < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			free(buf);
+			return false;
+		}
+		sha256.update(buf, got);
+	}
+	free(buf);
+	return true;
+}
+
+#ifndef _WIN32
+// Hash the file from start to size, as read() from the current position would; windows stay
+// page-aligned, so the first one may begin before start. MAP_POPULATE reads each window in up front.
+static bool sha256_mmap(int fd, uint64_t start, uint64_t size, SHA256 &sha256)
+{
+	uint64_t page = sysconf(_SC_PAGESIZE);
+	for (uint64_t off = start & ~(page - 1); off < size; off += MAP_WINDOW)
+	{
+		uint64_t len = size - off < MAP_WINDOW ? size - off : MAP_WINDOW;
+		void *p = mmap(NULL, len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, off);
+		if (p == MAP_FAILED)
+			return false;
+		uint64_t skip = off < start ? start - off : 0;
+		sha256.update((const uint8_t *)p + skip, len - skip);
+		munmap(p, len);
+	}
+	// leave the position at the end, as read() would
+	return lseek(fd, size, SEEK_SET) == (off_t)size;
+}
+#endif
+
+bool sha256_fd(int fd, uint32_t digest[8])
+{
+	SHA256 sha256;
+	bool ok = false;
+#ifndef _WIN32
+	struct stat st;
+	off_t start = lseek(fd, 0, SEEK_CUR); // an inherited stdin may already be partly read
+	if (start >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > start)
+	{
+		ok = sha256_mmap(fd, start, st.st_size, sha256);
+		// the mapping can fail on special filesystems; start over with read()
+		if (!ok)
+		{
+			if (lseek(fd, start, SEEK_SET) != start)
+				return false;
+			sha256 = SHA256();
+		}
+	}
+#endif
+	if (!ok)
+		ok = sha256_read(fd, sha256);
+	if (!ok)
+		return false;
+	sha256.final();
+	memcpy(digest, sha256.state, sizeof(sha256.state));
+	return true;
+}
+
+bool sha256_file(const char *path, uint32_t digest[8])
+{
+	if (!strcmp(path, "-"))
+		return sha256_fd(0, digest);
+	int fd = open(path, O_RDONLY | O_BINARY);
+	if (fd < 0)
+		return false;
+	bool ok = sha256_fd(fd, digest);
+	close(fd);
+	return ok;
+}
+
+void print_digest(const uint32_t digest[8])
+{
+	cout << hex << setfill('0');
+	for (int i = 0; i < 8; i++)
+		cout << setw(8) << digest[i];
+	cout << dec << setfill(' ');
+}
+
+static bool sha256_file_async(const char *path, uint32_t digest[8])
+{
+	int fd = strcmp(path, "-") ? open(path, O_RDONLY | O_BINARY) : 0;
+	if (fd < 0)
+		return false;
+	PipelineStats st;
+	bool ok = sha256_fd_async(fd, digest, &st);
+	if (fd)
+		close(fd);
+	if (ok)
+		cerr << path << ": " << st.bytes / st.total / 1e6 << " MB/s in " << st.total << " s, read " << st.read
+			 << " s, hash " << st.hash << " s, hashing stalled on I/O " << st.io_wait
+			 << " s, reading stalled on hashing " << st.hash_wait << " s" << endl;
+	return ok;
+}
+
+static bool sha256_file_tree(const char *path, TreeHash &tree, int threads)
+{
+	int fd = strcmp(path, "-") ? open(path, O_RDONLY | O_BINARY) : 0;
+	if (fd < 0)
+		return false;
+	bool ok = sha256_tree_fd(fd, tree, threads);
+	if (fd)
+		close(fd);
+	return ok;
+}
+
+// Byte count with an optional k, M or G suffix (powers of 1024)
+static uint64_t parse_size(const char *s)
+{
+	char *end;
+	uint64_t n = strtoull(s, &end, 0);
+	switch (*end)
+	{
+	case 'k':
+	case 'K':
+		return n << 10;
+	case 'M':
+		return n << 20;
+	case 'G':
+		return n << 30;
+	}
+	return n;
+}
+
+// Plain files through the digest cache; stdin and other non-regular files are always hashed
+static bool sha256_file_cached(const char *path, DigestCache &cache, uint32_t digest[8])
+{
+	if (!strcmp(path, "-"))
+		return sha256_fd(0, digest);
+	int fd = open(path, O_RDONLY | O_BINARY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	bool ok = fstat(fd, &st) == 0;
+	bool regular = ok && S_ISREG(st.st_mode);
+	if (ok && !(regular && cache.lookup(st, digest)))
+	{
+		ok = sha256_fd(fd, digest);
+		if (ok && regular)
+			cache.store(st, digest);
+	}
+	close(fd);
+	return ok;
+}
+
+// Content-defined chunking of each file against one shared chunk index; the totals cover all files
+static int dedup_files(int argc, char *argv[], uint32_t avgSize, int threads, bool list)
+{
+	CDCParams params = {avgSize / 4, avgSize, avgSize * 8};
+	if (!cdc_valid(params))
+	{
+		cerr << "chunk size must be a power of two from 256 to " << CDC_MAX_CHUNK / 8 << endl;
+		return 2;
+	}
+	ChunkIndex index;
+	DedupStats total = {};
+	int status = 0;
+	for (int i = 0; i < argc; i++)
+	{
+		int fd = strcmp(argv[i], "-") ? open(argv[i], O_RDONLY | O_BINARY) : 0;
+		DedupStats st;
+		const char *path = argv[i];
+		bool ok = fd >= 0 && sha256_dedup_fd(fd, params, threads, index, &st, [&](const CDCChunk &c)
+											 {
+			if (!list)
+				return;
+			print_digest(c.digest);
+			cout << "  " << path << "@" << c.offset << "+" << c.length << (c.duplicate ? " dup" : "") << "\n"; });
+		if (fd > 0)
+			close(fd);
+		if (!ok)
+		{
+			perror(argv[i]);
+			status = 1;
+			continue;
+		}
+		cerr << argv[i] << ": " << st.bytes << " bytes in " << st.chunks << " chunks, " << st.bytes - st.uniqueBytes
+			 << " duplicate bytes, " << st.bytes / st.total / 1e6 << " MB/s; busy read " << st.read << " s, chunk "
+			 << st.chunk << " s, hash " << st.hash << " s, index " << st.index << " s of " << st.total << " s" << endl;
+		total.bytes += st.bytes;
+		total.chunks += st.chunks;
+		total.uniqueBytes += st.uniqueBytes;
+		total.uniqueChunks += st.uniqueChunks;
+	}
+	cout << "total: " << total.bytes << " bytes, " << total.chunks << " chunks, " << total.uniqueChunks << " unique chunks, "
+		 << total.bytes - total.uniqueBytes << " duplicate bytes (" << (total.bytes ? 100.0 * (total.bytes - total.uniqueBytes) / total.bytes : 0)
+		 << "%)" << endl;
+	return status;
+}
+
+// sha256sum-style output: one "digest  path" line per file
+// -a: hash through the double-buffered reader thread and report where the time went
+// -r: hash every regular file below each argument on -j threads, one line per file sorted by path
+// -t: print the Merkle root of the tree hash instead, using -j threads and -C byte chunks;
+//     -l adds one "digest  path#i" line per chunk
+// -k: hash a single file resumably, checkpointing to the given path every -K bytes (default 1G);
+//     rerunning the same command after an interruption continues from the last checkpoint
+// -D: split each file into content-defined chunks of about -C bytes (default 8K), hash them on -j threads
+//     and report duplicate bytes across all files; -l lists every chunk as "digest  path@offset+length"
+// -c: look files up in the given digest cache first and add the ones that had to be hashed (plain and -r)
+int sha256sum(int argc, char *argv[])
+{
+	bool async = false, tree = false, list = false, recursive = false, dedup = false, chunkSet = false;
+	int threads = 0;
+	uint64_t chunkSize = 1 << 20;
+	const char *checkpoint = NULL;
+	uint64_t interval = 1ull << 30;
+	const char *cachePath = NULL;
+	int i = 0;
+	sha256_dispatch_init(); // before any worker thread reads the backend pointers
+	for (; i < argc && argv[i][0] == '-' && argv[i][1]; i++)
+	{
+		if (!strcmp(argv[i], "--"))
+		{
+			i++;
+			break;
+		}
+		if (!strcmp(argv[i], "-a"))
+			async = true;
+		else if (!strcmp(argv[i], "-r"))
+			recursive = true;
+		else if (!strcmp(argv[i], "-D"))
+			dedup = true;
+		else if (!strcmp(argv[i], "-t"))
+			tree = true;
+		else if (!strcmp(argv[i], "-l"))
+			list = true;
+		else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-C") && i + 1 < argc)
+		{
+			chunkSize = parse_size(argv[++i]);
+			chunkSet = true;
+		}
+		else if (!strcmp(argv[i], "-k") && i + 1 < argc)
+			checkpoint = argv[++i];
+		else if (!strcmp(argv[i], "-K") && i + 1 < argc)
+			interval = parse_size(argv[++i]);
+		else if (!strcmp(argv[i], "-c") && i + 1 < argc)
+			cachePath = argv[++i];
+		else
+		{
+			cerr << "unknown option " << argv[i] << endl;
+			return 2;
+		}
+	}
+	if (recursive && (async || tree))
+	{
+		cerr << "-r cannot be combined with -a or -t" << endl;
+		return 2;
+	}
+	if (dedup)
+	{
+		if (async || tree || recursive || checkpoint || cachePath)
+		{
+			cerr << "-D cannot be combined with -a, -r, -t, -k or -c" << endl;
+			return 2;
+		}
+		return dedup_files(argc - i, argv + i, chunkSet ? chunkSize : CDC_DEFAULT.avgSize, threads, list);
+	}
+	if (cachePath && (async || tree || checkpoint))
+	{
+		cerr << "-c cannot be combined with -a, -t or -k" << endl;
+		return 2;
+	}
+	if (tree && (chunkSize == 0 || chunkSize % sysconf(_SC_PAGESIZE)))
+	{
+		cerr << "chunk size must be a multiple of " << sysconf(_SC_PAGESIZE) << endl;
+		return 2;
+	}
+	if (checkpoint)
+	{
+		if (argc - i != 1 || async || tree || recursive)
+		{
+			cerr << "-k takes exactly one file and no -a, -r or -t" << endl;
+			return 2;
+		}
+		uint32_t digest[8];
+		int fd = strcmp(argv[i], "-") ? open(argv[i], O_RDONLY | O_BINARY) : 0;
+		bool ok = fd >= 0 && sha256_fd_resumable(fd, checkpoint, interval, digest);
+		if (fd > 0)
+			close(fd);
+		if (!ok)
+		{
+			perror(argv[i]);
+			return 1;
+		}
+		print_digest(digest);
+		cout << "  " << argv[i] << endl;
+		return 0;
+	}
+
+	DigestCache cache;
+	if (cachePath && !cache.open(cachePath))
+	{
+		perror(cachePath);
+		return 2;
+	}
+	int status = 0;
+	for (; i < argc; i++)
+	{
+		uint32_t digest[8];
+		if (recursive)
+		{
+			vector<ManifestEntry> manifest;
+			if (!sha256_dir(argv[i], threads, cachePath ? &cache : NULL, manifest))
+				status = 1;
+			for (auto &e : manifest)
+			{
+				print_digest(e.digest);
+				cout << "  " << e.path << "\n";
+			}
+			continue;
+		}
+		if (tree)
+		{
+			TreeHash th;
+			th.chunkSize = chunkSize;
+			if (!sha256_file_tree(argv[i], th, threads))
+			{
+				perror(argv[i]);
+				status = 1;
+				continue;
+			}
+			print_digest(th.root);
+			cout << "  " << argv[i] << endl;
+			for (size_t c = 0; list && c < th.leaves.size() / 8; c++)
+			{
+				print_digest(&th.leaves[8 * c]);
+				cout << "  " << argv[i] << "#" << c << endl;
+			}
+			continue;
+		}
+		bool ok;
+		if (cachePath)
+			ok = sha256_file_cached(argv[i], cache, digest);
+		else
+			ok = async ? sha256_file_async(argv[i], digest) : sha256_file(argv[i], digest);
+		if (!ok)
+		{
+			perror(argv[i]);
+			status = 1;
+			continue;
+		}
+		print_digest(digest);
+		cout << "  " << argv[i] << endl;
+	}
+	if (cachePath)
+		cerr << cachePath << ": " << cache.hits << " hits, " << cache.misses << " misses, " << cache.stale << " stale" << endl;
+	return status;
+}
@@ -0,0 +1,170 @@
+#ifndef _SHA256_FIXED_H
+#define _SHA256_FIXED_H
+
+#include "sha256.h"
+
+// SHA-256 of messages whose length N is known at compile time, e.g. 32-byte keys and digests,
+// 64-byte node pairs or 80-byte block headers. The padding of the last block is fixed, so its
+// constant schedule words and their K256 sums come from constexpr tables instead of padding loops.
+
+template <int N>
+struct FixedTail
+{
+	static_assert(N % 4 == 0 && N % BLOCK_SIZE <= 52, "message must be whole words and leave room for the padding in its last block");
+	static const int FULL = N / BLOCK_SIZE;      // whole message blocks before the last one
+	static const int WORDS = N % BLOCK_SIZE / 4; // message words in the last block
+
+	uint8_t block[BLOCK_SIZE]; // the last block with its message bytes left zero
+	uint32_t w[64];            // its schedule; if WORDS > 0 only w[WORDS..15] are independent of the message
+	uint32_t kw[64];           // K256[i] + w[i] wherever w[i] is constant
+
+	constexpr FixedTail() : block(), w(), kw()
+	{
+		uint64_t bitLen = (uint64_t)N * 8;
+		block[N % BLOCK_SIZE] = 0x80;
+		for (int i = 0; i < 8; i++)
+			block[56 + i] = (bitLen >> ((7 - i) * 8)) & 0xFF;
+		for (int i = 0; i < 16; i++)
+			w[i] = (block[i * 4] << 24) | (block[i * 4 + 1] << 16) | (block[i * 4 + 2] << 8) | block[i * 4 + 3];
+		for (int i = 16; i < 64; i++)
+		{
+			uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+			uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+		for (int i = 0; i < 64; i++)
+			kw[i] = K256[i] + w[i];
+	}
+};
+
+template <int N>
+constexpr FixedTail<N> fixed_tail;
+
+template <int N>
+void sha256_fixed(const uint8_t *data, uint32_t digest[8])
+{
+	typedef FixedTail<N> T;
+	const T &t = fixed_tail<N>;
+	memcpy(digest, H256, sizeof(H256));
+	sha256_dispatch_init();
+	if (sha256_transform_id == TRANSFORM_SHA_NI)
+	{
+		// SHA-NI expands the schedule itself; it still gets the ready-made padding in one call
+		uint8_t buf[(T::FULL + 1) * BLOCK_SIZE];
+		memcpy(buf, data, N);
+		memcpy(buf + N, t.block + N % BLOCK_SIZE, BLOCK_SIZE - N % BLOCK_SIZE);
+		sha256_ni_blocks(digest, buf, T::FULL + 1);
+		return;
+	}
+
+	for (int i = 0; i < T::FULL; i++)
+		sha256_compress(digest, data + i * BLOCK_SIZE);
+	const uint8_t *tail = data + T::FULL * BLOCK_SIZE;
+	uint32_t w[64];
+#pragma GCC unroll 64
+	for (int i = 0; i < 64; i++)
+		w[i] = i < T::WORDS ? (tail[i * 4] << 24) | (tail[i * 4 + 1] << 16) | (tail[i * 4 + 2] << 8) | tail[i * 4 + 3] : t.w[i];
+	if (T::WORDS)
+	{
+		// fully unrolled, so the zero padding words drop out of the expansion
+#pragma GCC unroll 48
+		for (int i = 16; i < 64; i++)
+		{
+			uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+			uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+	}
+
+	uint32_t a = digest[0], b = digest[1], c = digest[2], d = digest[3];
+	uint32_t e = digest[4], f = digest[5], g = digest[6], h = digest[7];
+#pragma GCC unroll 64
+	for (int i = 0; i < 64; i++)
+	{
+		bool constant = i >= T::WORDS && (i < 16 || !T::WORDS);
+		uint32_t S1 = ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25);
+		uint32_t ch = (e & f) ^ ((~e) & g);
+		uint32_t temp1 = h + S1 + ch + (constant ? t.kw[i] : K256[i] + w[i]);
+		uint32_t S0 = ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22);
+		uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+		uint32_t temp2 = S0 + maj;
+		h = g;
+		g = f;
+		f = e;
+		e = d + temp1;
+		d = c;
+		c = b;
+		b = a;
+		a = temp1 + temp2;
+	}
+	digest[0] += a;
+	digest[1] += b;
+	digest[2] += c;
+	digest[3] += d;
+	digest[4] += e;
+	digest[5] += f;
+	digest[6] += g;
+	digest[7] += h;
+}
+
+// The last block of a 65-byte message, a Merkle prefix byte and two child digests: word 0 holds the
+// last message byte and the 0x80 padding byte, words 1..14 are zero and word 15 is the bit length.
+// Only word 0 differs between messages. var[i] says whether schedule word i depends on it; fixed[i]
+// is the sum of the terms of word i that do not, the whole word where var[i] is false.
+struct Tail65
+{
+	bool var[64];
+	uint32_t fixed[64];
+
+	constexpr Tail65() : var(), fixed()
+	{
+		var[0] = true;
+		fixed[15] = 65 * 8;
+		for (int i = 16; i < 64; i++)
+		{
+			const uint32_t w15 = fixed[i - 15], w2 = fixed[i - 2];
+			var[i] = var[i - 16] || var[i - 15] || var[i - 7] || var[i - 2];
+			fixed[i] = (var[i - 16] ? 0 : fixed[i - 16]) + (var[i - 7] ? 0 : fixed[i - 7]);
+			if (!var[i - 15])
+				fixed[i] += ROTR(w15, 7) ^ ROTR(w15, 18) ^ (w15 >> 3);
+			if (!var[i - 2])
+				fixed[i] += ROTR(w2, 17) ^ ROTR(w2, 19) ^ (w2 >> 10);
+		}
+	}
+};
+
+constexpr Tail65 tail65;
+
+// Word 0 of that block for a 64-byte message msg
+static inline uint32_t tail65_w0(const uint8_t *msg)
+{
+	return (uint32_t)msg[BLOCK_SIZE - 1] << 24 | 0x80 << 16;
+}
+
+// Compress the last block of a 65-byte message from its word 0. Fully unrolled, the terms on zero
+// words drop out of the expansion, which is a few additions and sigma1s until word 30.
+static inline void sha256_compress_tail65(uint32_t *state, uint32_t w0)
+{
+	const Tail65 &t = tail65;
+	uint32_t w[64], wk[64];
+#pragma GCC unroll 64
+	for (int i = 0; i < 64; i++)
+	{
+		w[i] = i == 0 ? w0 : t.fixed[i];
+		if (i >= 16 && t.var[i])
+		{
+			if (t.var[i - 16])
+				w[i] += w[i - 16];
+			if (t.var[i - 15])
+				w[i] += ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+			if (t.var[i - 7])
+				w[i] += w[i - 7];
+			if (t.var[i - 2])
+				w[i] += ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		}
+		wk[i] = K256[i] + w[i];
+	}
+	sha256_compress_wk(state, wk);
+}
+
+#endif
@@ -0,0 +1,175 @@
+#include <vector>
+#include <algorithm>
+#include "sha256.h"
+#include "sha256_fixed.h"
+using namespace std;
+
+// An HMAC over a 32-byte message or digest is 64 + 32 = 96 bytes behind either pad block, so the
+// second block of both the inner and the outer hash carries the padding of a 96-byte message.
+static const FixedTail<96> &pad96 = fixed_tail<96>;
+
+HMACKey::HMACKey(const uint8_t *key, size_t len)
+{
+	uint8_t k[BLOCK_SIZE] = {0};
+	if (len > BLOCK_SIZE)
+	{
+		SHA256 sha256;
+		sha256.update(key, len);
+		sha256.final();
+		digest_bytes(sha256.state, k);
+	}
+	else
+		memcpy(k, key, len);
+
+	uint8_t block[BLOCK_SIZE];
+	for (int i = 0; i < BLOCK_SIZE; i++)
+		block[i] = k[i] ^ 0x36;
+	memcpy(inner, H256, sizeof(inner));
+	sha256_transform(inner, block, 1);
+	for (int i = 0; i < BLOCK_SIZE; i++)
+		block[i] = k[i] ^ 0x5c;
+	memcpy(outer, H256, sizeof(outer));
+	sha256_transform(outer, block, 1);
+}
+
+HMAC_SHA256::HMAC_SHA256(const HMACKey &key) : key(key)
+{
+	memcpy(inner.state, key.inner, sizeof(inner.state));
+	inner.totalBytes = BLOCK_SIZE;
+}
+
+void HMAC_SHA256::final(uint8_t mac[DIGEST_SIZE])
+{
+	inner.final();
+	uint8_t block[BLOCK_SIZE];
+	digest_bytes(inner.state, block);
+	memcpy(block + DIGEST_SIZE, pad96.block + DIGEST_SIZE, BLOCK_SIZE - DIGEST_SIZE);
+	uint32_t state[8];
+	memcpy(state, key.outer, sizeof(state));
+	sha256_transform(state, block, 1);
+	digest_bytes(state, mac);
+}
+
+void hmac_sha256(const HMACKey &key, const uint8_t *msg, uint64_t len, uint8_t mac[DIGEST_SIZE])
+{
+	HMAC_SHA256 hmac(key);
+	hmac.update(msg, len);
+	hmac.final(mac);
+}
+
+// One output block T_i of one password
+struct PBKDF2Chain
+{
+	const HMACKey *key;
+	uint32_t u[8], t[8];
+	uint8_t *out;
+	size_t len; // bytes of T_i that go to out
+};
+
+// Iterations of a single chain with the single-stream kernel
+static void pbkdf2_serial(PBKDF2Chain &c, uint64_t iterations, bool ni)
+{
+	uint8_t block[BLOCK_SIZE];
+	memcpy(block, pad96.block, BLOCK_SIZE);
+	for (uint64_t it = 0; it < iterations; it++)
+	{
+		uint32_t s[8];
+		memcpy(s, c.key->inner, sizeof(s));
+		digest_bytes(c.u, block);
+		if (ni)
+			sha256_ni_blocks(s, block, 1);
+		else
+			sha256_compress(s, block);
+		memcpy(c.u, c.key->outer, sizeof(c.u));
+		digest_bytes(s, block);
+		if (ni)
+			sha256_ni_blocks(c.u, block, 1);
+		else
+			sha256_compress(c.u, block);
+		for (int j = 0; j < 8; j++)
+			c.t[j] ^= c.u[j];
+	}
+}
+
+// Chains in groups of lanes; the spare lanes of the last group repeat its last chain
+static void pbkdf2_lanes(vector<PBKDF2Chain> &chains, uint64_t iterations, int lanes)
+{
+	uint32_t ipad[8 * MB_LANES_AVX512], opad[8 * MB_LANES_AVX512], u[8 * MB_LANES_AVX512], t[8 * MB_LANES_AVX512];
+	for (size_t i = 0; i < chains.size(); i += lanes)
+	{
+		int n = min<size_t>(lanes, chains.size() - i);
+		for (int l = 0; l < lanes; l++)
+		{
+			const PBKDF2Chain &c = chains[i + min(l, n - 1)];
+			for (int j = 0; j < 8; j++)
+			{
+				ipad[j * lanes + l] = c.key->inner[j];
+				opad[j * lanes + l] = c.key->outer[j];
+				u[j * lanes + l] = c.u[j];
+				t[j * lanes + l] = c.t[j];
+			}
+		}
+		if (lanes == MB_LANES_AVX512)
+			pbkdf2_x16_avx512(ipad, opad, u, t, iterations);
+		else
+			pbkdf2_x8_avx2(ipad, opad, u, t, iterations);
+		for (int l = 0; l < n; l++)
+			for (int j = 0; j < 8; j++)
+				chains[i + l].t[j] = t[j * lanes + l];
+	}
+}
+
+void pbkdf2_hmac_sha256_batch(const PBKDF2Job *jobs, size_t count, uint64_t iterations)
+{
+	vector<HMACKey> keys;
+	keys.reserve(count);
+	vector<PBKDF2Chain> chains;
+	for (size_t i = 0; i < count; i++)
+	{
+		const PBKDF2Job &job = jobs[i];
+		keys.emplace_back(job.password, job.passwordLen);
+		for (uint32_t b = 1; (uint64_t)(b - 1) * DIGEST_SIZE < job.outLen; b++)
+		{
+			// U_1 = HMAC(password, salt || INT(b))
+			PBKDF2Chain c;
+			c.key = &keys.back();
+			c.out = job.out + (b - 1) * DIGEST_SIZE;
+			c.len = min<size_t>(DIGEST_SIZE, job.outLen - (b - 1) * DIGEST_SIZE);
+			uint8_t be[4] = {(uint8_t)(b >> 24), (uint8_t)(b >> 16), (uint8_t)(b >> 8), (uint8_t)b};
+			uint8_t mac[DIGEST_SIZE];
+			HMAC_SHA256 hmac(*c.key);
+			hmac.update(job.salt, job.saltLen);
+			hmac.update(be, 4);
+			hmac.final(mac);
+			for (int j = 0; j < 8; j++)
+				c.u[j] = c.t[j] = (mac[j * 4] << 24) | (mac[j * 4 + 1] << 16) | (mac[j * 4 + 2] << 8) | mac[j * 4 + 3];
+			chains.push_back(c);
+		}
+	}
+
+	if (iterations > 1)
+	{
+		int lanes = sha256_batch_lanes();
+		// a mostly idle vector loses to SHA-NI running the few chains one after another
+		if (lanes > 1 && sha256_transform_id == TRANSFORM_SHA_NI && chains.size() * 4 <= (size_t)lanes)
+			lanes = 1;
+		if (lanes > 1)
+			pbkdf2_lanes(chains, iterations - 1, lanes);
+		else
+			for (auto &c : chains)
+				pbkdf2_serial(c, iterations - 1, lanes == 1);
+	}
+	for (auto &c : chains)
+	{
+		uint8_t block[DIGEST_SIZE];
+		digest_bytes(c.t, block);
+		memcpy(c.out, block, c.len);
+	}
+}
+
+void pbkdf2_hmac_sha256(const uint8_t *password, size_t passwordLen, const uint8_t *salt, size_t saltLen,
+						uint64_t iterations, uint8_t *out, size_t outLen)
+{
+	PBKDF2Job job = {password, passwordLen, salt, saltLen, out, outLen};
+	pbkdf2_hmac_sha256_batch(&job, 1, iterations);
+}
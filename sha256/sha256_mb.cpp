@@ -0,0 +1,522 @@
+#include <immintrin.h>
+#include <cstring>
+#include <algorithm>
+#include "sha256.h"
+#include "sha256_fixed.h"
+#include "sha256_mb.h"
+using namespace std;
+
+// Multi-buffer SHA-256: the same round is applied to several independent messages,
+// one message per 32-bit SIMD lane, so no SHA extensions are needed.
+
+static const uint8_t zero_block[BLOCK_SIZE] = {0};
+
+#define ROTR8(x, n) _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n))
+
+// 64 rounds on 8 lanes, leaving the working variables in x. w holds message words 0-15 and is
+// expanded in place; if wk is given, the schedule is skipped and wk[i] holds W[i] + K256[i] of every lane.
+__attribute__((target("avx2"), always_inline)) static inline void rounds_x8(const __m256i s[8], __m256i w[16], const __m256i *wk, __m256i x[8])
+{
+	__m256i a = s[0], b = s[1], c = s[2], d = s[3];
+	__m256i e = s[4], f = s[5], g = s[6], h = s[7];
+	for (int i = 0; i < 64; i++)
+	{
+		__m256i kw;
+		if (wk)
+			kw = wk[i];
+		else
+		{
+			__m256i wi;
+			if (i < 16)
+				wi = w[i];
+			else
+			{
+				__m256i w15 = w[(i - 15) & 15], w2 = w[(i - 2) & 15];
+				__m256i s0 = _mm256_xor_si256(_mm256_xor_si256(ROTR8(w15, 7), ROTR8(w15, 18)), _mm256_srli_epi32(w15, 3));
+				__m256i s1 = _mm256_xor_si256(_mm256_xor_si256(ROTR8(w2, 17), ROTR8(w2, 19)), _mm256_srli_epi32(w2, 10));
+				wi = _mm256_add_epi32(_mm256_add_epi32(w[i & 15], s0), _mm256_add_epi32(w[(i - 7) & 15], s1));
+				w[i & 15] = wi;
+			}
+			kw = _mm256_add_epi32(wi, _mm256_set1_epi32(K256[i]));
+		}
+		__m256i S1 = _mm256_xor_si256(_mm256_xor_si256(ROTR8(e, 6), ROTR8(e, 11)), ROTR8(e, 25));
+		__m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+		__m256i temp1 = _mm256_add_epi32(_mm256_add_epi32(h, S1), _mm256_add_epi32(ch, kw));
+		__m256i S0 = _mm256_xor_si256(_mm256_xor_si256(ROTR8(a, 2), ROTR8(a, 13)), ROTR8(a, 22));
+		__m256i maj = _mm256_xor_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_xor_si256(a, b)));
+		__m256i temp2 = _mm256_add_epi32(S0, maj);
+		h = g;
+		g = f;
+		f = e;
+		e = _mm256_add_epi32(d, temp1);
+		d = c;
+		c = b;
+		b = a;
+		a = _mm256_add_epi32(temp1, temp2);
+	}
+	x[0] = a, x[1] = b, x[2] = c, x[3] = d;
+	x[4] = e, x[5] = f, x[6] = g, x[7] = h;
+}
+
+__attribute__((target("avx2"))) void sha256_x8_avx2(uint32_t *state, const uint8_t *const *data, const uint64_t *nblocks, uint64_t n)
+{
+	const __m256i flip = _mm256_setr_epi8(
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	__m256i s[8];
+	for (int j = 0; j < 8; j++)
+		s[j] = _mm256_loadu_si256((const __m256i *)(state + j * 8));
+
+	for (uint64_t it = 0; it < n; it++)
+	{
+		const uint8_t *p[8];
+		int32_t active[8];
+		for (int l = 0; l < 8; l++)
+		{
+			active[l] = it < nblocks[l] ? -1 : 0;
+			p[l] = active[l] ? data[l] + it * BLOCK_SIZE : zero_block;
+		}
+		__m256i mask = _mm256_loadu_si256((const __m256i *)active);
+
+		// load 8 words of 8 lanes and transpose them so that w[j] holds word j of every lane
+		__m256i w[16];
+		for (int half = 0; half < 2; half++)
+		{
+			__m256i r[8], t[8], u[8];
+			for (int l = 0; l < 8; l++)
+				r[l] = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(p[l] + half * 32)), flip);
+			for (int l = 0; l < 8; l += 2)
+			{
+				t[l] = _mm256_unpacklo_epi32(r[l], r[l + 1]);
+				t[l + 1] = _mm256_unpackhi_epi32(r[l], r[l + 1]);
+			}
+			for (int l = 0; l < 8; l += 4)
+			{
+				u[l + 0] = _mm256_unpacklo_epi64(t[l], t[l + 2]);
+				u[l + 1] = _mm256_unpackhi_epi64(t[l], t[l + 2]);
+				u[l + 2] = _mm256_unpacklo_epi64(t[l + 1], t[l + 3]);
+				u[l + 3] = _mm256_unpackhi_epi64(t[l + 1], t[l + 3]);
+			}
+			for (int j = 0; j < 4; j++)
+			{
+				w[half * 8 + j] = _mm256_permute2x128_si256(u[j], u[j + 4], 0x20);
+				w[half * 8 + j + 4] = _mm256_permute2x128_si256(u[j], u[j + 4], 0x31);
+			}
+		}
+
+		__m256i x[8];
+		rounds_x8(s, w, NULL, x);
+		for (int j = 0; j < 8; j++)
+			s[j] = _mm256_blendv_epi8(s[j], _mm256_add_epi32(s[j], x[j]), mask);
+	}
+
+	for (int j = 0; j < 8; j++)
+		_mm256_storeu_si256((__m256i *)(state + j * 8), s[j]);
+}
+
+#define ROTR16(x, n) _mm512_ror_epi32(x, n)
+
+// 64 rounds on 16 lanes, see rounds_x8
+__attribute__((target("avx512f"), always_inline)) static inline void rounds_x16(const __m512i s[8], __m512i w[16], const __m512i *wk, __m512i x[8])
+{
+	__m512i a = s[0], b = s[1], c = s[2], d = s[3];
+	__m512i e = s[4], f = s[5], g = s[6], h = s[7];
+	for (int i = 0; i < 64; i++)
+	{
+		__m512i kw;
+		if (wk)
+			kw = wk[i];
+		else
+		{
+			__m512i wi;
+			if (i < 16)
+				wi = w[i];
+			else
+			{
+				__m512i w15 = w[(i - 15) & 15], w2 = w[(i - 2) & 15];
+				__m512i s0 = _mm512_ternarylogic_epi32(ROTR16(w15, 7), ROTR16(w15, 18), _mm512_srli_epi32(w15, 3), 0x96);
+				__m512i s1 = _mm512_ternarylogic_epi32(ROTR16(w2, 17), ROTR16(w2, 19), _mm512_srli_epi32(w2, 10), 0x96);
+				wi = _mm512_add_epi32(_mm512_add_epi32(w[i & 15], s0), _mm512_add_epi32(w[(i - 7) & 15], s1));
+				w[i & 15] = wi;
+			}
+			kw = _mm512_add_epi32(wi, _mm512_set1_epi32(K256[i]));
+		}
+		__m512i S1 = _mm512_ternarylogic_epi32(ROTR16(e, 6), ROTR16(e, 11), ROTR16(e, 25), 0x96);
+		__m512i ch = _mm512_ternarylogic_epi32(e, f, g, 0xCA);
+		__m512i temp1 = _mm512_add_epi32(_mm512_add_epi32(h, S1), _mm512_add_epi32(ch, kw));
+		__m512i S0 = _mm512_ternarylogic_epi32(ROTR16(a, 2), ROTR16(a, 13), ROTR16(a, 22), 0x96);
+		__m512i maj = _mm512_ternarylogic_epi32(a, b, c, 0xE8);
+		__m512i temp2 = _mm512_add_epi32(S0, maj);
+		h = g;
+		g = f;
+		f = e;
+		e = _mm512_add_epi32(d, temp1);
+		d = c;
+		c = b;
+		b = a;
+		a = _mm512_add_epi32(temp1, temp2);
+	}
+	x[0] = a, x[1] = b, x[2] = c, x[3] = d;
+	x[4] = e, x[5] = f, x[6] = g, x[7] = h;
+}
+
+// AVX-512F only: byte swap with rotates, and the 3-input boolean functions with vpternlogd.
+// Lane activity is a k mask, so finished lanes are neither loaded nor updated.
+__attribute__((target("avx512f"))) void sha256_x16_avx512(uint32_t *state, const uint8_t *const *data, const uint64_t *nblocks, uint64_t n)
+{
+	const __m512i lowbytes = _mm512_set1_epi32(0x00FF00FF);
+	__m512i s[8];
+	for (int j = 0; j < 8; j++)
+		s[j] = _mm512_loadu_si512(state + j * 16);
+
+	for (uint64_t it = 0; it < n; it++)
+	{
+		__mmask16 k = 0;
+		for (int l = 0; l < 16; l++)
+			k |= (it < nblocks[l]) << l;
+
+		// load one block per active lane, then transpose 16x16 so that w[j] holds word j of every lane
+		__m512i r[16], t[16], u[16], w[16];
+		for (int l = 0; l < 16; l++)
+		{
+			__m512i x = _mm512_maskz_loadu_epi32((k >> l) & 1 ? 0xFFFF : 0, data[l] + it * BLOCK_SIZE);
+			r[l] = _mm512_ternarylogic_epi32(_mm512_rol_epi32(x, 8), _mm512_ror_epi32(x, 8), lowbytes, 0xE4);
+		}
+		for (int l = 0; l < 16; l += 2)
+		{
+			t[l] = _mm512_unpacklo_epi32(r[l], r[l + 1]);
+			t[l + 1] = _mm512_unpackhi_epi32(r[l], r[l + 1]);
+		}
+		for (int l = 0; l < 16; l += 4)
+		{
+			u[l + 0] = _mm512_unpacklo_epi64(t[l], t[l + 2]);
+			u[l + 1] = _mm512_unpackhi_epi64(t[l], t[l + 2]);
+			u[l + 2] = _mm512_unpacklo_epi64(t[l + 1], t[l + 3]);
+			u[l + 3] = _mm512_unpackhi_epi64(t[l + 1], t[l + 3]);
+		}
+		// u[4 * g + j] now holds words j, 4 + j, 8 + j, 12 + j of rows 4g..4g+3, one per 128-bit chunk
+		for (int j = 0; j < 4; j++)
+		{
+			__m512i v0 = _mm512_shuffle_i32x4(u[j], u[4 + j], 0x88);
+			__m512i v1 = _mm512_shuffle_i32x4(u[j], u[4 + j], 0xDD);
+			__m512i v2 = _mm512_shuffle_i32x4(u[8 + j], u[12 + j], 0x88);
+			__m512i v3 = _mm512_shuffle_i32x4(u[8 + j], u[12 + j], 0xDD);
+			w[j] = _mm512_shuffle_i32x4(v0, v2, 0x88);
+			w[4 + j] = _mm512_shuffle_i32x4(v1, v3, 0x88);
+			w[8 + j] = _mm512_shuffle_i32x4(v0, v2, 0xDD);
+			w[12 + j] = _mm512_shuffle_i32x4(v1, v3, 0xDD);
+		}
+
+		__m512i x[8];
+		rounds_x16(s, w, NULL, x);
+		for (int j = 0; j < 8; j++)
+			s[j] = _mm512_mask_add_epi32(s[j], k, s[j], x[j]);
+	}
+
+	for (int j = 0; j < 8; j++)
+		_mm512_storeu_si512(state + j * 16, s[j]);
+}
+
+// One more block on every lane: the last block of a 65-byte message (see Tail65), word 0 of lane l
+// in w0[l]. The schedule words that do not depend on word 0 are constants with K256 folded in.
+__attribute__((target("avx2"))) void sha256_x8_avx2_tail65(uint32_t *state, const uint32_t *w0)
+{
+	const Tail65 &t = tail65;
+	__m256i s[8], w[64], wk[64], x[8];
+	for (int j = 0; j < 8; j++)
+		s[j] = _mm256_loadu_si256((const __m256i *)(state + j * 8));
+#pragma GCC unroll 64
+	for (int i = 0; i < 64; i++)
+	{
+		if (!t.var[i])
+		{
+			wk[i] = _mm256_set1_epi32(K256[i] + t.fixed[i]);
+			continue;
+		}
+		if (i == 0)
+			w[i] = _mm256_loadu_si256((const __m256i *)w0);
+		else
+		{
+			w[i] = _mm256_set1_epi32(t.fixed[i]);
+			if (t.var[i - 16])
+				w[i] = _mm256_add_epi32(w[i], w[i - 16]);
+			if (t.var[i - 15])
+				w[i] = _mm256_add_epi32(w[i], _mm256_xor_si256(_mm256_xor_si256(ROTR8(w[i - 15], 7), ROTR8(w[i - 15], 18)), _mm256_srli_epi32(w[i - 15], 3)));
+			if (t.var[i - 7])
+				w[i] = _mm256_add_epi32(w[i], w[i - 7]);
+			if (t.var[i - 2])
+				w[i] = _mm256_add_epi32(w[i], _mm256_xor_si256(_mm256_xor_si256(ROTR8(w[i - 2], 17), ROTR8(w[i - 2], 19)), _mm256_srli_epi32(w[i - 2], 10)));
+		}
+		wk[i] = _mm256_add_epi32(w[i], _mm256_set1_epi32(K256[i]));
+	}
+	rounds_x8(s, NULL, wk, x);
+	for (int j = 0; j < 8; j++)
+		_mm256_storeu_si256((__m256i *)(state + j * 8), _mm256_add_epi32(s[j], x[j]));
+}
+
+__attribute__((target("avx512f"))) void sha256_x16_avx512_tail65(uint32_t *state, const uint32_t *w0)
+{
+	const Tail65 &t = tail65;
+	__m512i s[8], w[64], wk[64], x[8];
+	for (int j = 0; j < 8; j++)
+		s[j] = _mm512_loadu_si512(state + j * 16);
+#pragma GCC unroll 64
+	for (int i = 0; i < 64; i++)
+	{
+		if (!t.var[i])
+		{
+			wk[i] = _mm512_set1_epi32(K256[i] + t.fixed[i]);
+			continue;
+		}
+		if (i == 0)
+			w[i] = _mm512_loadu_si512(w0);
+		else
+		{
+			w[i] = _mm512_set1_epi32(t.fixed[i]);
+			if (t.var[i - 16])
+				w[i] = _mm512_add_epi32(w[i], w[i - 16]);
+			if (t.var[i - 15])
+				w[i] = _mm512_add_epi32(w[i], _mm512_ternarylogic_epi32(ROTR16(w[i - 15], 7), ROTR16(w[i - 15], 18), _mm512_srli_epi32(w[i - 15], 3), 0x96));
+			if (t.var[i - 7])
+				w[i] = _mm512_add_epi32(w[i], w[i - 7]);
+			if (t.var[i - 2])
+				w[i] = _mm512_add_epi32(w[i], _mm512_ternarylogic_epi32(ROTR16(w[i - 2], 17), ROTR16(w[i - 2], 19), _mm512_srli_epi32(w[i - 2], 10), 0x96));
+		}
+		wk[i] = _mm512_add_epi32(w[i], _mm512_set1_epi32(K256[i]));
+	}
+	rounds_x16(s, NULL, wk, x);
+	for (int j = 0; j < 8; j++)
+		_mm512_storeu_si512(state + j * 16, _mm512_add_epi32(s[j], x[j]));
+}
+
+// Double SHA-256 of 80-byte headers that differ only in the little-endian nonce at byte 76.
+// mid is the state after the first 64 bytes, tail[0..2] the big-endian words of bytes 64..75;
+// lane l uses nonce0 + l. The first digest feeds the second hash as message words directly.
+__attribute__((target("avx2"))) void sha256d_x8_avx2(const uint32_t mid[8], const uint32_t tail[3], uint32_t nonce0, uint32_t *out)
+{
+	const __m256i flip = _mm256_setr_epi8(
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	__m256i s[8], w[16], x[8];
+	for (int j = 0; j < 8; j++)
+		s[j] = _mm256_set1_epi32(mid[j]);
+	for (int i = 0; i < 3; i++)
+		w[i] = _mm256_set1_epi32(tail[i]);
+	__m256i nonce = _mm256_add_epi32(_mm256_set1_epi32(nonce0), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+	w[3] = _mm256_shuffle_epi8(nonce, flip);
+	for (int i = 4; i < 16; i++)
+		w[i] = _mm256_set1_epi32(fixed_tail<80>.w[i]);
+	rounds_x8(s, w, NULL, x);
+
+	for (int j = 0; j < 8; j++)
+	{
+		w[j] = _mm256_add_epi32(s[j], x[j]);
+		s[j] = _mm256_set1_epi32(H256[j]);
+	}
+	for (int i = 8; i < 16; i++)
+		w[i] = _mm256_set1_epi32(fixed_tail<32>.w[i]);
+	rounds_x8(s, w, NULL, x);
+	for (int j = 0; j < 8; j++)
+		_mm256_storeu_si256((__m256i *)(out + j * 8), _mm256_add_epi32(s[j], x[j]));
+}
+
+__attribute__((target("avx512f"))) void sha256d_x16_avx512(const uint32_t mid[8], const uint32_t tail[3], uint32_t nonce0, uint32_t *out)
+{
+	__m512i s[8], w[16], x[8];
+	for (int j = 0; j < 8; j++)
+		s[j] = _mm512_set1_epi32(mid[j]);
+	for (int i = 0; i < 3; i++)
+		w[i] = _mm512_set1_epi32(tail[i]);
+	__m512i nonce = _mm512_add_epi32(_mm512_set1_epi32(nonce0), _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+	w[3] = _mm512_ternarylogic_epi32(_mm512_rol_epi32(nonce, 8), _mm512_ror_epi32(nonce, 8), _mm512_set1_epi32(0x00FF00FF), 0xE4);
+	for (int i = 4; i < 16; i++)
+		w[i] = _mm512_set1_epi32(fixed_tail<80>.w[i]);
+	rounds_x16(s, w, NULL, x);
+
+	for (int j = 0; j < 8; j++)
+	{
+		w[j] = _mm512_add_epi32(s[j], x[j]);
+		s[j] = _mm512_set1_epi32(H256[j]);
+	}
+	for (int i = 8; i < 16; i++)
+		w[i] = _mm512_set1_epi32(fixed_tail<32>.w[i]);
+	rounds_x16(s, w, NULL, x);
+	for (int j = 0; j < 8; j++)
+		_mm512_storeu_si512(out + j * 16, _mm512_add_epi32(s[j], x[j]));
+}
+
+// PBKDF2-HMAC-SHA256 iterations on independent chains. ipad and opad are each chain's cached key
+// states, u its previous U and t the XOR of all U so far, all word-major. An iteration is one inner
+// block (U plus the padding of a 96-byte message) and one outer block (the inner digest, same padding).
+__attribute__((target("avx2"))) void pbkdf2_x8_avx2(const uint32_t *ipad, const uint32_t *opad, uint32_t *u, uint32_t *t, uint64_t iterations)
+{
+	__m256i si[8], so[8], uu[8], tt[8], s[8], w[16], x[8];
+	for (int j = 0; j < 8; j++)
+	{
+		si[j] = _mm256_loadu_si256((const __m256i *)(ipad + j * 8));
+		so[j] = _mm256_loadu_si256((const __m256i *)(opad + j * 8));
+		uu[j] = _mm256_loadu_si256((const __m256i *)(u + j * 8));
+		tt[j] = _mm256_loadu_si256((const __m256i *)(t + j * 8));
+	}
+	for (uint64_t it = 0; it < iterations; it++)
+	{
+		for (int j = 0; j < 8; j++)
+		{
+			s[j] = si[j];
+			w[j] = uu[j];
+			w[j + 8] = _mm256_set1_epi32(fixed_tail<96>.w[j + 8]);
+		}
+		rounds_x8(s, w, NULL, x);
+		for (int j = 0; j < 8; j++)
+		{
+			w[j] = _mm256_add_epi32(s[j], x[j]);
+			w[j + 8] = _mm256_set1_epi32(fixed_tail<96>.w[j + 8]);
+		}
+		rounds_x8(so, w, NULL, x);
+		for (int j = 0; j < 8; j++)
+		{
+			uu[j] = _mm256_add_epi32(so[j], x[j]);
+			tt[j] = _mm256_xor_si256(tt[j], uu[j]);
+		}
+	}
+	for (int j = 0; j < 8; j++)
+	{
+		_mm256_storeu_si256((__m256i *)(u + j * 8), uu[j]);
+		_mm256_storeu_si256((__m256i *)(t + j * 8), tt[j]);
+	}
+}
+
+__attribute__((target("avx512f"))) void pbkdf2_x16_avx512(const uint32_t *ipad, const uint32_t *opad, uint32_t *u, uint32_t *t, uint64_t iterations)
+{
+	__m512i si[8], so[8], uu[8], tt[8], s[8], w[16], x[8];
+	for (int j = 0; j < 8; j++)
+	{
+		si[j] = _mm512_loadu_si512(ipad + j * 16);
+		so[j] = _mm512_loadu_si512(opad + j * 16);
+		uu[j] = _mm512_loadu_si512(u + j * 16);
+		tt[j] = _mm512_loadu_si512(t + j * 16);
+	}
+	for (uint64_t it = 0; it < iterations; it++)
+	{
+		for (int j = 0; j < 8; j++)
+		{
+			s[j] = si[j];
+			w[j] = uu[j];
+			w[j + 8] = _mm512_set1_epi32(fixed_tail<96>.w[j + 8]);
+		}
+		rounds_x16(s, w, NULL, x);
+		for (int j = 0; j < 8; j++)
+		{
+			w[j] = _mm512_add_epi32(s[j], x[j]);
+			w[j + 8] = _mm512_set1_epi32(fixed_tail<96>.w[j + 8]);
+		}
+		rounds_x16(so, w, NULL, x);
+		for (int j = 0; j < 8; j++)
+		{
+			uu[j] = _mm512_add_epi32(so[j], x[j]);
+			tt[j] = _mm512_xor_si512(tt[j], uu[j]);
+		}
+	}
+	for (int j = 0; j < 8; j++)
+	{
+		_mm512_storeu_si512(u + j * 16, uu[j]);
+		_mm512_storeu_si512(t + j * 16, tt[j]);
+	}
+}
+
+// Interleaved SHA-NI: S independent streams advance through the same rounds in one instruction
+// stream. A single stream is bound by the latency of its sha256rnds2 chain; with two, one stream's
+// rounds issue while the other's are still in flight. Four do not fit: each stream keeps eight xmm
+// registers live (state, saved state, four schedule words) and sha256rnds2 only reaches xmm0-15,
+// so the spills made four streams slower than one. Same contract as the lane kernels; a lane past
+// its block count computes on its last block and discards the result.
+template <int S>
+__attribute__((target("sha,sse4.1"), always_inline)) static inline void sha256_ni_interleaved(uint32_t *state, const uint8_t *const *data, const uint64_t *nblocks, uint64_t n)
+{
+	const __m128i flip = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i abef[S], cdgh[S], save0[S], save1[S], m[S][4];
+	const uint8_t *p[S];
+	for (int s = 0; s < S; s++)
+	{
+		// DCBA, HGFE -> ABEF, CDGH
+		__m128i t = _mm_set_epi32(state[3 * S + s], state[2 * S + s], state[1 * S + s], state[0 * S + s]);
+		__m128i u = _mm_set_epi32(state[7 * S + s], state[6 * S + s], state[5 * S + s], state[4 * S + s]);
+		t = _mm_shuffle_epi32(t, 0xB1);
+		u = _mm_shuffle_epi32(u, 0x1B);
+		abef[s] = _mm_alignr_epi8(t, u, 8);
+		cdgh[s] = _mm_blend_epi16(u, t, 0xF0);
+		p[s] = data[s];
+	}
+
+	for (uint64_t i = 0; i < n; i++)
+	{
+#pragma GCC unroll 4
+		for (int s = 0; s < S; s++)
+		{
+			save0[s] = abef[s];
+			save1[s] = cdgh[s];
+		}
+#pragma GCC unroll 16
+		for (int r = 0; r < 16; r++)
+		{
+#pragma GCC unroll 4
+			for (int s = 0; s < S; s++)
+			{
+				__m128i &w = m[s][r & 3];
+				if (r < 4)
+					w = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p[s] + r * 16)), flip);
+				else
+				{
+					__m128i t = _mm_add_epi32(_mm_sha256msg1_epu32(w, m[s][(r - 3) & 3]), _mm_alignr_epi8(m[s][(r - 1) & 3], m[s][(r - 2) & 3], 4));
+					w = _mm_sha256msg2_epu32(t, m[s][(r - 1) & 3]);
+				}
+				__m128i k = _mm_add_epi32(w, _mm_loadu_si128((const __m128i *)(K256 + r * 4)));
+				cdgh[s] = _mm_sha256rnds2_epu32(cdgh[s], abef[s], k);
+				abef[s] = _mm_sha256rnds2_epu32(abef[s], cdgh[s], _mm_shuffle_epi32(k, 0x0E));
+			}
+		}
+#pragma GCC unroll 4
+		for (int s = 0; s < S; s++)
+		{
+			// branch-free, so the compiler keeps the streams in one basic block
+			__m128i active = _mm_set1_epi32(-(int)(i < nblocks[s]));
+			abef[s] = _mm_add_epi32(save0[s], _mm_and_si128(abef[s], active));
+			cdgh[s] = _mm_add_epi32(save1[s], _mm_and_si128(cdgh[s], active));
+			p[s] += (i + 1 < nblocks[s]) * BLOCK_SIZE;
+		}
+	}
+
+	for (int s = 0; s < S; s++)
+	{
+		// ABEF, CDGH -> DCBA, HGFE
+		__m128i t = _mm_shuffle_epi32(abef[s], 0x1B);
+		__m128i u = _mm_shuffle_epi32(cdgh[s], 0xB1);
+		__m128i dcba = _mm_blend_epi16(t, u, 0xF0);
+		__m128i hgfe = _mm_alignr_epi8(u, t, 8);
+		uint32_t w[8];
+		_mm_storeu_si128((__m128i *)w, dcba);
+		_mm_storeu_si128((__m128i *)(w + 4), hgfe);
+		for (int j = 0; j < 8; j++)
+			state[j * S + s] = w[j];
+	}
+}
+
+__attribute__((target("sha,sse4.1"))) void sha256_ni_x2(uint32_t *state, const uint8_t *const *data, const uint64_t *nblocks, uint64_t n)
+{
+	sha256_ni_interleaved<NI_LANES_X2>(state, data, nblocks, n);
+}
+
+void sha256_mb_avx2(const uint8_t *const *msgs, const uint64_t *lens, uint32_t (*digests)[8], size_t count)
+{
+	mb_hash<uint32_t, MB_LANES_AVX2>(sha256_x8_avx2, H256, msgs, lens, digests, count);
+}
+
+void sha256_mb_avx512(const uint8_t *const *msgs, const uint64_t *lens, uint32_t (*digests)[8], size_t count)
+{
+	mb_hash<uint32_t, MB_LANES_AVX512>(sha256_x16_avx512, H256, msgs, lens, digests, count);
+}
+
+void sha256_mb_sha_ni(const uint8_t *const *msgs, const uint64_t *lens, uint32_t (*digests)[8], size_t count)
+{
+	mb_hash<uint32_t, NI_LANES_X2>(sha256_ni_x2, H256, msgs, lens, digests, count);
+}
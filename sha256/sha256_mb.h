@@ -0,0 +1,122 @@
+#ifndef _SHA256_MB_H
+#define _SHA256_MB_H
+
+#include <cstring>
+#include <algorithm>
+#include "sha256.h"
+
+// The lane scheduler of the multi-buffer kernels, shared by SHA-256 (sha256_mb.cpp) and SHA-512
+// (sha512.cpp). Word is the state word: a block is 16 of them and the length field at its end 2.
+
+template <typename Word>
+struct MBLane
+{
+	static const int BLOCK = 16 * sizeof(Word);
+
+	size_t job;          // index of the message in this lane
+	bool busy;           // false if the lane has no message
+	const uint8_t *data; // current run of blocks
+	uint64_t blocks;     // blocks left in the current run
+	int tailBlocks;      // padded tail blocks still to run after it
+	uint8_t tail[2 * BLOCK];
+
+	// Build the padded tail (last partial block, 0x80, zeros and bit length) of a message.
+	// Returns the number of tail blocks, 1 or 2.
+	int pad(const uint8_t *msg, uint64_t len)
+	{
+		const int LEN = 2 * sizeof(Word); // bytes in the length field
+		uint64_t rem = len % BLOCK;
+		int n = rem < BLOCK - LEN ? 1 : 2;
+		memset(tail, 0, n * BLOCK);
+		memcpy(tail, msg + len - rem, rem);
+		tail[rem] = 0x80;
+		uint64_t bitLen = len * 8;
+		for (int i = 0; i < 8; i++)
+			tail[n * BLOCK - 8 + i] = (bitLen >> ((7 - i) * 8)) & 0xFF;
+		// a 128-bit field also gets the bits shifted out of len * 8
+		if (LEN > 8)
+			tail[n * BLOCK - 9] = len >> 61;
+		return n;
+	}
+};
+
+// Hash count messages from the initial state iv. Whenever a lane finishes its message, the digest
+// is retired and the next message is loaded into that lane. While messages are still waiting, the
+// kernel runs until the shortest lane ends; once the queue is empty it runs to the longest one and
+// finished lanes just keep their state.
+template <typename Word, int LANES>
+static void mb_hash(void (*kernel)(Word *state, const uint8_t *const *data, const uint64_t *nblocks, uint64_t n),
+					const Word iv[8], const uint8_t *const *msgs, const uint64_t *lens, Word (*digests)[8], size_t count)
+{
+	typedef MBLane<Word> Lane;
+	static const uint8_t zero[Lane::BLOCK] = {0};
+	Lane lane[LANES];
+	Word state[8 * LANES];
+	const uint8_t *ptr[LANES];
+	uint64_t nblocks[LANES];
+	size_t next = 0;
+	for (int l = 0; l < LANES; l++)
+		lane[l].busy = false;
+
+	while (true)
+	{
+		int busy = 0;
+		for (int l = 0; l < LANES; l++)
+		{
+			if (!lane[l].busy && next < count)
+			{
+				Lane &ln = lane[l];
+				ln.job = next++;
+				ln.busy = true;
+				ln.data = msgs[ln.job];
+				ln.blocks = lens[ln.job] / Lane::BLOCK;
+				ln.tailBlocks = ln.pad(msgs[ln.job], lens[ln.job]);
+				if (ln.blocks == 0)
+				{
+					ln.data = ln.tail;
+					ln.blocks = ln.tailBlocks;
+					ln.tailBlocks = 0;
+				}
+				for (int j = 0; j < 8; j++)
+					state[j * LANES + l] = iv[j];
+			}
+			busy += lane[l].busy;
+		}
+		if (!busy)
+			break;
+
+		uint64_t n = next < count ? UINT64_MAX : 0;
+		for (int l = 0; l < LANES; l++)
+		{
+			ptr[l] = lane[l].busy ? lane[l].data : zero;
+			nblocks[l] = lane[l].busy ? lane[l].blocks : 0;
+			if (lane[l].busy)
+				n = next < count ? std::min(n, nblocks[l]) : std::max(n, nblocks[l]);
+		}
+		kernel(state, ptr, nblocks, n);
+
+		for (int l = 0; l < LANES; l++)
+		{
+			Lane &ln = lane[l];
+			if (!ln.busy)
+				continue;
+			uint64_t done = std::min(n, ln.blocks);
+			ln.data += done * Lane::BLOCK;
+			ln.blocks -= done;
+			if (ln.blocks)
+				continue;
+			if (ln.tailBlocks)
+			{
+				ln.data = ln.tail;
+				ln.blocks = ln.tailBlocks;
+				ln.tailBlocks = 0;
+				continue;
+			}
+			for (int j = 0; j < 8; j++)
+				digests[ln.job][j] = state[j * LANES + l];
+			ln.busy = false;
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,116 @@
+#include <thread>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include "sha256.h"
+using namespace std;
+
+// Double-buffered file hashing: a reader thread fills a ring of aligned buffers
+// while the calling thread drains them through SHA256::update(), so reading the
+// next buffer overlaps with hashing the current one.
+
+const int RING_SLOTS = 4;
+const size_t SLOT_SIZE = 4 << 20;
+
+struct RingSlot
+{
+	uint8_t *data;
+	size_t len;
+	bool full; // filled by the reader, not yet hashed
+	bool last; // holds the end of the input
+};
+
+typedef SlotRing<RingSlot, RING_SLOTS> Ring;
+
+size_t read_fill(int fd, uint8_t *buf, size_t size, bool &eof, bool &error)
+{
+	size_t len = 0;
+	eof = error = false;
+	while (len < size)
+	{
+		ssize_t got = read(fd, buf + len, size - len);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got <= 0)
+		{
+			eof = true;
+			error = got < 0;
+			break;
+		}
+		len += got;
+	}
+	return len;
+}
+
+static void reader(int fd, Ring &ring, PipelineStats &stats)
+{
+	for (int i = 0;; i = (i + 1) % RING_SLOTS)
+	{
+		RingSlot &s = ring.slot[i];
+		auto t = chrono::steady_clock::now();
+		ring.wait([&]
+				  { return !s.full; });
+		stats.hash_wait += seconds_since(t);
+
+		// fill the whole slot unless the input ends first
+		t = chrono::steady_clock::now();
+		bool eof, error;
+		size_t len = read_fill(fd, s.data, SLOT_SIZE, eof, error);
+		stats.read += seconds_since(t);
+
+		ring.publish([&]
+					 {
+			s.len = len;
+			s.full = true;
+			s.last = eof;
+			ring.error = error; });
+		if (eof)
+			return;
+	}
+}
+
+bool sha256_fd_async(int fd, uint32_t digest[8], PipelineStats *stats)
+{
+	Ring ring;
+	PipelineStats st = {};
+	if (!ring.alloc(SLOT_SIZE))
+		return false;
+#ifdef POSIX_FADV_SEQUENTIAL
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	auto total = chrono::steady_clock::now();
+	thread th(reader, fd, ref(ring), ref(st));
+	SHA256 sha256;
+	for (int i = 0;; i = (i + 1) % RING_SLOTS)
+	{
+		RingSlot &s = ring.slot[i];
+		auto t = chrono::steady_clock::now();
+		bool last;
+		{
+			auto lock = ring.wait([&]
+								  { return s.full; });
+			last = s.last;
+		}
+		st.io_wait += seconds_since(t);
+
+		t = chrono::steady_clock::now();
+		sha256.update(s.data, s.len);
+		st.hash += seconds_since(t);
+		st.bytes += s.len;
+
+		ring.publish([&]
+					 { s.full = false; });
+		if (last)
+			break;
+	}
+	th.join();
+	st.total = seconds_since(total);
+	if (stats)
+		*stats = st;
+	if (ring.error)
+		return false;
+	sha256.final();
+	memcpy(digest, sha256.state, sizeof(sha256.state));
+	return true;
+}
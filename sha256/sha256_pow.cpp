@@ -0,0 +1,192 @@
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include "sha256.h"
+#include "sha256_fixed.h"
+using namespace std;
+
+// Nonces are handed to the threads in slices; a thread checks between slices whether another one has already won
+const uint64_t POW_SLICE = 1 << 16;
+
+enum PowBackend
+{
+	POW_GENERIC,
+	POW_SHA_NI,
+	POW_AVX2,
+	POW_AVX512,
+};
+
+static int pow_backend(const char *name)
+{
+	sha256_dispatch_init();
+	if (!name)
+	{
+		switch (sha256_batch_lanes())
+		{
+		case MB_LANES_AVX512:
+			return POW_AVX512;
+		case MB_LANES_AVX2:
+			return POW_AVX2;
+		case 1:
+			return POW_SHA_NI;
+		}
+		return POW_GENERIC;
+	}
+	if (!strcmp(name, "generic"))
+		return POW_GENERIC;
+	if (!strcmp(name, "sha_ni"))
+		return cpu_features.sha_ni ? POW_SHA_NI : -1;
+	if (!strcmp(name, "avx2"))
+		return cpu_features.avx2 ? POW_AVX2 : -1;
+	if (!strcmp(name, "avx512"))
+		return cpu_features.avx512 ? POW_AVX512 : -1;
+	return -1;
+}
+
+bool sha256d_supported(const char *backend)
+{
+	return pow_backend(backend) >= 0;
+}
+
+void sha256d(const uint8_t header[POW_HEADER_SIZE], uint8_t out[DIGEST_SIZE])
+{
+	uint32_t d[8];
+	sha256_fixed<POW_HEADER_SIZE>(header, d);
+	digest_bytes(d, out);
+	sha256_fixed<DIGEST_SIZE>(out, d);
+	digest_bytes(d, out);
+}
+
+static bool meets_target(const uint8_t hash[DIGEST_SIZE], const uint8_t target[DIGEST_SIZE])
+{
+	for (int i = DIGEST_SIZE - 1; i >= 0; i--)
+		if (hash[i] != target[i])
+			return hash[i] < target[i];
+	return true;
+}
+
+static inline uint32_t load_be32(const uint8_t *p)
+{
+	return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+struct PowJob
+{
+	uint32_t mid[8];           // state after header bytes 0..63
+	uint32_t tail[3];          // header bytes 64..75 as big-endian words
+	uint8_t block[BLOCK_SIZE]; // second block with its padding, nonce at byte 12
+	uint32_t top;              // most significant word of the target
+	const uint8_t *target;
+};
+
+// The hash's most significant word is the byte-swapped last state word; a candidate only needs the
+// full comparison if that word does not already decide it
+static inline bool check(const PowJob &job, const uint32_t d[8], uint8_t hash[DIGEST_SIZE])
+{
+	if (__builtin_bswap32(d[7]) > job.top)
+		return false;
+	digest_bytes(d, hash);
+	return meets_target(hash, job.target);
+}
+
+// Hash nonces [first, first + n) and return the index of the first hit, or n
+static uint64_t search_range(const PowJob &job, int backend, uint32_t first, uint64_t n, uint8_t hash[DIGEST_SIZE])
+{
+	if (backend == POW_AVX2 || backend == POW_AVX512)
+	{
+		const int lanes = backend == POW_AVX512 ? MB_LANES_AVX512 : MB_LANES_AVX2;
+		uint32_t out[8 * MB_LANES_AVX512];
+		for (uint64_t i = 0; i < n; i += lanes)
+		{
+			if (backend == POW_AVX512)
+				sha256d_x16_avx512(job.mid, job.tail, first + i, out);
+			else
+				sha256d_x8_avx2(job.mid, job.tail, first + i, out);
+			for (int l = 0; l < lanes && i + l < n; l++)
+			{
+				uint32_t d[8];
+				for (int j = 0; j < 8; j++)
+					d[j] = out[j * lanes + l];
+				if (check(job, d, hash))
+					return i + l;
+			}
+		}
+		return n;
+	}
+
+	uint8_t block[BLOCK_SIZE], outer[BLOCK_SIZE];
+	memcpy(block, job.block, BLOCK_SIZE);
+	memcpy(outer, fixed_tail<DIGEST_SIZE>.block, BLOCK_SIZE);
+	for (uint64_t i = 0; i < n; i++)
+	{
+		uint32_t nonce = first + i;
+		memcpy(block + 12, &nonce, 4);
+		uint32_t d[8];
+		memcpy(d, job.mid, sizeof(d));
+		if (backend == POW_SHA_NI)
+		{
+			sha256_ni_blocks(d, block, 1);
+			digest_bytes(d, outer);
+			memcpy(d, H256, sizeof(d));
+			sha256_ni_blocks(d, outer, 1);
+		}
+		else
+		{
+			sha256_compress(d, block);
+			digest_bytes(d, outer);
+			memcpy(d, H256, sizeof(d));
+			sha256_compress(d, outer);
+		}
+		if (check(job, d, hash))
+			return i;
+	}
+	return n;
+}
+
+bool sha256d_search(const uint8_t header[POW_HEADER_SIZE], const uint8_t target[DIGEST_SIZE], uint32_t start, uint64_t count,
+					int threads, const char *backend, NonceResult &result)
+{
+	int b = pow_backend(backend);
+	result.found = false;
+	result.hashes = 0;
+	if (b < 0)
+		return false;
+	count = min<uint64_t>(count, (1ull << 32) - start);
+
+	PowJob job;
+	memcpy(job.mid, H256, sizeof(job.mid));
+	sha256_compress(job.mid, header);
+	for (int i = 0; i < 3; i++)
+		job.tail[i] = load_be32(header + BLOCK_SIZE + i * 4);
+	memcpy(job.block, header + BLOCK_SIZE, POW_HEADER_SIZE - BLOCK_SIZE);
+	memcpy(job.block + POW_HEADER_SIZE - BLOCK_SIZE, fixed_tail<POW_HEADER_SIZE>.block + POW_HEADER_SIZE - BLOCK_SIZE,
+		   BLOCK_SIZE - (POW_HEADER_SIZE - BLOCK_SIZE));
+	job.top = target[28] | (target[29] << 8) | (target[30] << 16) | ((uint32_t)target[31] << 24);
+	job.target = target;
+
+	atomic<bool> stop(false);
+	atomic<uint64_t> hashes(0);
+	mutex m;
+	parallel_for((count + POW_SLICE - 1) / POW_SLICE, threads, [&](size_t s)
+				 {
+		if (stop)
+			return;
+		uint64_t off = s * POW_SLICE, n = min(POW_SLICE, count - off);
+		uint8_t hash[DIGEST_SIZE];
+		uint64_t hit = search_range(job, b, start + off, n, hash);
+		hashes += hit < n ? hit + 1 : n;
+		if (hit < n)
+		{
+			lock_guard<mutex> lock(m);
+			if (!result.found || start + off + hit < result.nonce)
+			{
+				result.found = true;
+				result.nonce = start + off + hit;
+				memcpy(result.hash, hash, DIGEST_SIZE);
+			}
+			stop = true;
+		} });
+	result.hashes = hashes;
+	return result.found;
+}
@@ -0,0 +1,164 @@
+#include <immintrin.h>
+#include "sha256.h"
+using namespace std;
+
+// Single-stream backends for CPUs without SHA extensions, after OpenSSL's
+// sha256_block_data_order_{ssse3,avx,avx2}: the message schedule is expanded four words
+// per vector while the scalar rounds run. Each group of four rounds stores W + K of its
+// words to the stack and expands the schedule group sixteen words ahead, which has no
+// dependency on those rounds, so the vector and integer units work at the same time.
+
+#define ROTR4(x, n) _mm_or_si128(_mm_srli_epi32(x, n), _mm_slli_epi32(x, 32 - n))
+#define ROTR4x2(x, n) _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n))
+
+// One round; the caller rotates the eight working variables by renaming them
+#define ROUND(a, b, c, d, e, f, g, h, wk)                                                       \
+	do                                                                                          \
+	{                                                                                           \
+		uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + wk; \
+		d += t1;                                                                                \
+		h = t1 + (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));     \
+	} while (0)
+
+#define ROUNDS4(a, b, c, d, e, f, g, h, wk)    \
+	ROUND(a, b, c, d, e, f, g, h, (wk)[0]); \
+	ROUND(h, a, b, c, d, e, f, g, (wk)[1]); \
+	ROUND(g, h, a, b, c, d, e, f, (wk)[2]); \
+	ROUND(f, g, h, a, b, c, d, e, (wk)[3])
+
+// W[t + 16 .. t + 19] from x0 = W[t .. t + 3] up to x3 = W[t + 12 .. t + 15]. W[t + 18] and
+// W[t + 19] depend on W[t + 16] and W[t + 17], so sigma1 is applied twice: to the top words of x3,
+// then to the bottom words of the result.
+__attribute__((target("ssse3"), always_inline)) static inline __m128i schedule_next(__m128i x0, __m128i x1, __m128i x2, __m128i x3)
+{
+	__m128i w15 = _mm_alignr_epi8(x1, x0, 4);
+	__m128i w7 = _mm_alignr_epi8(x3, x2, 4);
+	__m128i s0 = _mm_xor_si128(_mm_xor_si128(ROTR4(w15, 7), ROTR4(w15, 18)), _mm_srli_epi32(w15, 3));
+	__m128i t = _mm_add_epi32(_mm_add_epi32(x0, s0), w7);
+	__m128i lo = _mm_srli_si128(x3, 8);
+	t = _mm_add_epi32(t, _mm_xor_si128(_mm_xor_si128(ROTR4(lo, 17), ROTR4(lo, 19)), _mm_srli_epi32(lo, 10)));
+	__m128i hi = _mm_slli_si128(t, 8);
+	return _mm_add_epi32(t, _mm_xor_si128(_mm_xor_si128(ROTR4(hi, 17), ROTR4(hi, 19)), _mm_srli_epi32(hi, 10)));
+}
+
+__attribute__((target("avx2"), always_inline)) static inline __m256i schedule_next_x2(__m256i x0, __m256i x1, __m256i x2, __m256i x3)
+{
+	__m256i w15 = _mm256_alignr_epi8(x1, x0, 4);
+	__m256i w7 = _mm256_alignr_epi8(x3, x2, 4);
+	__m256i s0 = _mm256_xor_si256(_mm256_xor_si256(ROTR4x2(w15, 7), ROTR4x2(w15, 18)), _mm256_srli_epi32(w15, 3));
+	__m256i t = _mm256_add_epi32(_mm256_add_epi32(x0, s0), w7);
+	__m256i lo = _mm256_srli_si256(x3, 8);
+	t = _mm256_add_epi32(t, _mm256_xor_si256(_mm256_xor_si256(ROTR4x2(lo, 17), ROTR4x2(lo, 19)), _mm256_srli_epi32(lo, 10)));
+	__m256i hi = _mm256_slli_si256(t, 8);
+	return _mm256_add_epi32(t, _mm256_xor_si256(_mm256_xor_si256(ROTR4x2(hi, 17), ROTR4x2(hi, 19)), _mm256_srli_epi32(hi, 10)));
+}
+
+// Four rounds from x (words i .. i + 3), then x becomes words i + 16 .. i + 19 while they run
+#define STEP_X4(x, x1, x2, x3, i, a, b, c, d, e, f, g, h)                                            \
+	do                                                                                                \
+	{                                                                                                 \
+		_mm_store_si128((__m128i *)wk, _mm_add_epi32(x, _mm_loadu_si128((const __m128i *)(K256 + i)))); \
+		if (i < 48)                                                                                   \
+			x = schedule_next(x, x1, x2, x3);                                                         \
+		ROUNDS4(a, b, c, d, e, f, g, h, wk);                                                          \
+	} while (0)
+
+__attribute__((target("ssse3"), always_inline)) static inline void transform_x4(uint32_t *state, const uint8_t *data, uint32_t numBlocks)
+{
+	const __m128i flip = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	alignas(16) uint32_t wk[4];
+	for (uint32_t n = 0; n < numBlocks; n++, data += BLOCK_SIZE)
+	{
+		__m128i x0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 0)), flip);
+		__m128i x1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16)), flip);
+		__m128i x2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 32)), flip);
+		__m128i x3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 48)), flip);
+		uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+		uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+#pragma GCC unroll 4
+		for (int i = 0; i < 64; i += 16)
+		{
+			STEP_X4(x0, x1, x2, x3, i, a, b, c, d, e, f, g, h);
+			STEP_X4(x1, x2, x3, x0, i + 4, e, f, g, h, a, b, c, d);
+			STEP_X4(x2, x3, x0, x1, i + 8, a, b, c, d, e, f, g, h);
+			STEP_X4(x3, x0, x1, x2, i + 12, e, f, g, h, a, b, c, d);
+		}
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+		state[5] += f;
+		state[6] += g;
+		state[7] += h;
+	}
+}
+
+__attribute__((target("ssse3"))) void sha256_ssse3_transform(uint32_t *state, const void *data, uint32_t numBlocks)
+{
+	transform_x4(state, (const uint8_t *)data, numBlocks);
+}
+
+// The same code with VEX encoding: three-operand forms save the register copies
+__attribute__((target("avx"))) void sha256_avx_transform(uint32_t *state, const void *data, uint32_t numBlocks)
+{
+	transform_x4(state, (const uint8_t *)data, numBlocks);
+}
+
+// STEP_X4 for two blocks: the rounds of the first block use the low half, the high half is kept
+// in wk1 for the second block's rounds
+#define STEP_X4X2(x, x1, x2, x3, i, a, b, c, d, e, f, g, h)                                                   \
+	do                                                                                                         \
+	{                                                                                                          \
+		__m256i kw = _mm256_add_epi32(x, _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(K256 + i)))); \
+		_mm_store_si128((__m128i *)wk, _mm256_castsi256_si128(kw));                                            \
+		_mm_store_si128((__m128i *)(wk1 + i), _mm256_extracti128_si256(kw, 1));                               \
+		if (i < 48)                                                                                            \
+			x = schedule_next_x2(x, x1, x2, x3);                                                               \
+		ROUNDS4(a, b, c, d, e, f, g, h, wk);                                                                   \
+	} while (0)
+
+// Two blocks per pass, b0 in the low and b1 in the high 128-bit half of each schedule vector, so the
+// second block's schedule comes for free and its rounds run from wk1 alone
+__attribute__((target("avx2"))) void sha256_avx2_transform(uint32_t *state, const void *data, uint32_t numBlocks)
+{
+	const __m256i flip = _mm256_setr_epi8(
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	const uint8_t *p = (const uint8_t *)data;
+	alignas(16) uint32_t wk[4], wk1[64];
+	for (uint32_t n = 0; n < numBlocks; n += 2, p += 2 * BLOCK_SIZE)
+	{
+		// an odd last block is scheduled twice
+		bool pair = n + 1 < numBlocks;
+		const uint8_t *q = pair ? p + BLOCK_SIZE : p;
+		__m256i x[4];
+		for (int j = 0; j < 4; j++)
+		{
+			__m256i r = _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(p + j * 16)));
+			r = _mm256_inserti128_si256(r, _mm_loadu_si128((const __m128i *)(q + j * 16)), 1);
+			x[j] = _mm256_shuffle_epi8(r, flip);
+		}
+		__m256i x0 = x[0], x1 = x[1], x2 = x[2], x3 = x[3];
+		uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+		uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+#pragma GCC unroll 4
+		for (int i = 0; i < 64; i += 16)
+		{
+			STEP_X4X2(x0, x1, x2, x3, i, a, b, c, d, e, f, g, h);
+			STEP_X4X2(x1, x2, x3, x0, i + 4, e, f, g, h, a, b, c, d);
+			STEP_X4X2(x2, x3, x0, x1, i + 8, a, b, c, d, e, f, g, h);
+			STEP_X4X2(x3, x0, x1, x2, i + 12, e, f, g, h, a, b, c, d);
+		}
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+		state[5] += f;
+		state[6] += g;
+		state[7] += h;
+		if (pair)
+			sha256_compress_wk(state, wk1);
+	}
+}
@@ -0,0 +1,267 @@
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <cstdlib>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+#include "sha256.h"
+#include "sha256_fixed.h"
+using namespace std;
+
+// Tree hash layout (stable, chunkSize is part of the result):
+//   leaf[i] = SHA-256(0x00 || bytes [i * chunkSize, (i + 1) * chunkSize) of the input), the last chunk
+//             may be short; an empty input has one empty leaf
+//   node    = SHA-256(0x01 || left || right), both children as 32-byte big-endian digests
+//   a level with an odd count promotes its last node unchanged to the next level
+//   root    = the single node left; with one chunk it is that chunk's leaf hash
+// The prefix bytes separate leaves from nodes as in RFC 6962: without them a file made of two leaf
+// digests would have the same root as the file those leaves came from.
+
+void parallel_for(size_t count, int threads, const function<void(size_t)> &fn)
+{
+	if (threads <= 0)
+		threads = thread::hardware_concurrency();
+	if (threads <= 1 || count <= 1)
+	{
+		for (size_t i = 0; i < count; i++)
+			fn(i);
+		return;
+	}
+	atomic<size_t> next(0);
+	auto worker = [&]
+	{
+		for (size_t i; (i = next++) < count;)
+			fn(i);
+	};
+	vector<thread> pool;
+	for (int t = 1; t < threads && (size_t)t < count; t++)
+		pool.emplace_back(worker);
+	worker();
+	for (auto &th : pool)
+		th.join();
+}
+
+// prefix || a 64-byte message is 65 bytes: the first block is the prefix and 63 message bytes, the
+// second carries the last message byte and the padding (Tail65)
+static void prefixed_first(uint8_t prefix, const uint8_t *msg, uint8_t out[BLOCK_SIZE])
+{
+	out[0] = prefix;
+	memcpy(out + 1, msg, BLOCK_SIZE - 1);
+}
+
+void sha256_prefixed_batch(uint8_t prefix, const uint8_t *msgs, size_t count, uint8_t *digests)
+{
+	static const int lanes = sha256_batch_lanes();
+	if (lanes <= 1)
+	{
+		// SHA-NI and the vector transforms expand the schedule alongside the rounds, so they take the
+		// whole second block; only the generic transform gains from skipping its expansion
+		static const bool whole = sha256_transform_id != TRANSFORM_GENERIC;
+		for (size_t i = 0; i < count; i++)
+		{
+			const uint8_t *msg = msgs + i * BLOCK_SIZE;
+			uint8_t blocks[2 * BLOCK_SIZE];
+			uint32_t state[8];
+			memcpy(state, H256, sizeof(H256));
+			prefixed_first(prefix, msg, blocks);
+			if (whole)
+			{
+				memset(blocks + BLOCK_SIZE, 0, BLOCK_SIZE);
+				blocks[BLOCK_SIZE] = msg[BLOCK_SIZE - 1];
+				blocks[BLOCK_SIZE + 1] = 0x80;
+				blocks[2 * BLOCK_SIZE - 2] = (BLOCK_SIZE + 1) * 8 >> 8;
+				blocks[2 * BLOCK_SIZE - 1] = (BLOCK_SIZE + 1) * 8 & 0xFF;
+				sha256_transform(state, blocks, 2);
+			}
+			else
+			{
+				sha256_transform(state, blocks, 1);
+				sha256_compress_tail65(state, tail65_w0(msg));
+			}
+			digest_bytes(state, digests + i * DIGEST_SIZE);
+		}
+		return;
+	}
+
+	uint8_t blocks[MB_LANES_AVX512][BLOCK_SIZE];
+	uint32_t state[8 * MB_LANES_AVX512], w0[MB_LANES_AVX512];
+	const uint8_t *ptr[MB_LANES_AVX512];
+	uint64_t nblocks[MB_LANES_AVX512];
+	for (size_t i = 0; i < count; i += lanes)
+	{
+		int n = min<size_t>(lanes, count - i);
+		for (int l = 0; l < lanes; l++)
+		{
+			// idle lanes repeat the last message and are not stored
+			const uint8_t *msg = msgs + (i + min(l, n - 1)) * BLOCK_SIZE;
+			if (l < n)
+				prefixed_first(prefix, msg, blocks[l]);
+			for (int j = 0; j < 8; j++)
+				state[j * lanes + l] = H256[j];
+			ptr[l] = blocks[min(l, n - 1)];
+			nblocks[l] = 1;
+			w0[l] = tail65_w0(msg);
+		}
+		if (lanes == MB_LANES_AVX512)
+		{
+			sha256_x16_avx512(state, ptr, nblocks, 1);
+			sha256_x16_avx512_tail65(state, w0);
+		}
+		else
+		{
+			sha256_x8_avx2(state, ptr, nblocks, 1);
+			sha256_x8_avx2_tail65(state, w0);
+		}
+		for (int l = 0; l < n; l++)
+		{
+			uint32_t d[8];
+			for (int j = 0; j < 8; j++)
+				d[j] = state[j * lanes + l];
+			digest_bytes(d, digests + (i + l) * DIGEST_SIZE);
+		}
+	}
+}
+
+size_t merkle_level(const uint8_t *nodes, size_t count, uint8_t *parents)
+{
+	size_t pairs = count / 2;
+	sha256_prefixed_batch(MERKLE_NODE, nodes, pairs, parents);
+	if (count % 2)
+		memmove(parents + pairs * DIGEST_SIZE, nodes + (count - 1) * DIGEST_SIZE, DIGEST_SIZE);
+	return pairs + count % 2;
+}
+
+void merkle_root32(const uint8_t *leaves, size_t count, uint8_t root[DIGEST_SIZE])
+{
+	// an empty tree's root is the hash of the empty string, as in RFC 6962
+	if (count == 0)
+	{
+		SHA256 sha256;
+		sha256.final();
+		digest_bytes(sha256.state, root);
+		return;
+	}
+	if (count == 1)
+	{
+		memcpy(root, leaves, DIGEST_SIZE);
+		return;
+	}
+	vector<uint8_t> a((count + 1) / 2 * DIGEST_SIZE), b((count + 3) / 4 * DIGEST_SIZE);
+	count = merkle_level(leaves, count, a.data());
+	while (count > 1)
+	{
+		count = merkle_level(a.data(), count, b.data());
+		swap(a, b);
+	}
+	memcpy(root, a.data(), DIGEST_SIZE);
+}
+
+void merkle_root64(const uint8_t *leaves, size_t count, uint8_t root[DIGEST_SIZE])
+{
+	vector<uint8_t> hashed(count * DIGEST_SIZE);
+	sha256_prefixed_batch(MERKLE_LEAF, leaves, count, hashed.data());
+	merkle_root32(hashed.data(), count, root);
+}
+
+void merkle_root(const uint32_t (*leaves)[8], size_t count, uint32_t root[8])
+{
+	vector<uint8_t> bytes(count * DIGEST_SIZE);
+	for (size_t i = 0; i < count; i++)
+		digest_bytes(leaves[i], &bytes[i * DIGEST_SIZE]);
+	uint8_t r[DIGEST_SIZE];
+	merkle_root32(bytes.data(), count, r);
+	for (int i = 0; i < 8; i++)
+		root[i] = (r[i * 4] << 24) | (r[i * 4 + 1] << 16) | (r[i * 4 + 2] << 8) | r[i * 4 + 3];
+}
+
+static void hash_leaf(const uint8_t *data, uint64_t len, uint32_t out[8])
+{
+	SHA256 sha256;
+	sha256.update(&MERKLE_LEAF, 1);
+	sha256.update(data, len);
+	sha256.final();
+	memcpy(out, sha256.state, sizeof(sha256.state));
+}
+
+#ifndef _WIN32
+// Each worker maps and hashes its own chunk, so every core reads a different part of the file
+static bool tree_mmap(int fd, uint64_t size, TreeHash &tree, int threads)
+{
+	atomic<bool> ok(true);
+	parallel_for(tree.leaves.size() / 8, threads, [&](size_t i)
+				 {
+		uint64_t off = i * tree.chunkSize;
+		uint64_t len = min(tree.chunkSize, size - off);
+		void *p = mmap(NULL, len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, off);
+		if (p == MAP_FAILED)
+		{
+			ok = false;
+			return;
+		}
+		hash_leaf((const uint8_t *)p, len, &tree.leaves[8 * i]);
+		munmap(p, len); });
+	return ok;
+}
+#endif
+
+// Pipes: read one chunk per thread, hash the batch in parallel, repeat
+static bool tree_read(int fd, TreeHash &tree, int threads)
+{
+	if (threads <= 0)
+		threads = thread::hardware_concurrency();
+	if (threads <= 0)
+		threads = 1;
+	vector<uint8_t *> buf(threads);
+	vector<uint64_t> len(threads);
+	bool ok = true, eof = false;
+	for (auto &b : buf)
+		ok = (b = (uint8_t *)malloc(tree.chunkSize)) && ok;
+	tree.leaves.clear();
+	while (ok && !eof)
+	{
+		int batch = 0;
+		for (; batch < threads && !eof; batch++)
+		{
+			bool error;
+			len[batch] = read_fill(fd, buf[batch], tree.chunkSize, eof, error);
+			ok = !error;
+			// a short chunk ends the input; an empty one is only kept for an empty input
+			if (eof && len[batch] == 0 && (batch || !tree.leaves.empty()))
+				batch--;
+		}
+		size_t first = tree.leaves.size() / 8;
+		tree.leaves.resize(tree.leaves.size() + 8 * batch);
+		parallel_for(batch, threads, [&](size_t i)
+					 { hash_leaf(buf[i], len[i], &tree.leaves[8 * (first + i)]); });
+	}
+	for (auto b : buf)
+		free(b);
+	return ok;
+}
+
+bool sha256_tree_fd(int fd, TreeHash &tree, int threads)
+{
+	bool ok = false, mapped = false;
+#ifndef _WIN32
+	struct stat st;
+	// the workers map chunks by file offset, so a partly read stdin goes through read() instead
+	if (lseek(fd, 0, SEEK_CUR) == 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+	{
+		uint64_t chunks = (st.st_size + tree.chunkSize - 1) / tree.chunkSize;
+		tree.leaves.assign(8 * chunks, 0);
+		mapped = ok = tree_mmap(fd, st.st_size, tree, threads);
+		if (!ok && lseek(fd, 0, SEEK_SET) != 0)
+			return false;
+	}
+#endif
+	if (!mapped)
+		ok = tree_read(fd, tree, threads);
+	if (!ok)
+		return false;
+	merkle_root((const uint32_t(*)[8])tree.leaves.data(), tree.leaves.size() / 8, tree.root);
+	return true;
+}
@@ -0,0 +1,192 @@
+#include <immintrin.h>
+#include <cstring>
+#include <algorithm>
+#include "sha512.h"
+#include "sha256_mb.h"
+using namespace std;
+
+static const uint8_t zero_block[SHA512_BLOCK_SIZE] = {0};
+
+#define ROTR64x4(x, n) _mm256_or_si256(_mm256_srli_epi64(x, n), _mm256_slli_epi64(x, 64 - n))
+
+// 80 rounds from a ready-made W + K
+static inline void sha512_rounds_wk(uint64_t *state, const uint64_t *wk)
+{
+	uint64_t a = state[0], b = state[1], c = state[2], d = state[3];
+	uint64_t e = state[4], f = state[5], g = state[6], h = state[7];
+	for (int i = 0; i < 80; i++)
+	{
+		uint64_t S1 = ROTR64(e, 14) ^ ROTR64(e, 18) ^ ROTR64(e, 41);
+		uint64_t ch = (e & f) ^ ((~e) & g);
+		uint64_t temp1 = h + S1 + ch + wk[i];
+		uint64_t S0 = ROTR64(a, 28) ^ ROTR64(a, 34) ^ ROTR64(a, 39);
+		uint64_t maj = (a & b) ^ (a & c) ^ (b & c);
+		uint64_t temp2 = S0 + maj;
+		h = g;
+		g = f;
+		f = e;
+		e = d + temp1;
+		d = c;
+		c = b;
+		b = a;
+		a = temp1 + temp2;
+	}
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+	state[5] += f;
+	state[6] += g;
+	state[7] += h;
+}
+
+// W + K of two blocks. Every register holds two consecutive words of b0 in its low half and the same
+// two words of b1 in its high half. W[t - 2] is the previous pair, so there is no dependency inside a pair.
+__attribute__((target("avx2"))) static void sha512_schedule_x2(const uint8_t *b0, const uint8_t *b1, uint64_t *wk0, uint64_t *wk1)
+{
+	const __m256i flip = _mm256_setr_epi8(
+		7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+		7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+	__m256i w[40];
+	for (int k = 0; k < 8; k++)
+	{
+		__m256i r = _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(b0 + k * 16)));
+		r = _mm256_inserti128_si256(r, _mm_loadu_si128((const __m128i *)(b1 + k * 16)), 1);
+		w[k] = _mm256_shuffle_epi8(r, flip);
+	}
+	for (int k = 8; k < 40; k++)
+	{
+		// words t - 15 and t - 7 straddle two pairs
+		__m256i w15 = _mm256_alignr_epi8(w[k - 7], w[k - 8], 8);
+		__m256i w7 = _mm256_alignr_epi8(w[k - 3], w[k - 4], 8);
+		__m256i s0 = _mm256_xor_si256(_mm256_xor_si256(ROTR64x4(w15, 1), ROTR64x4(w15, 8)), _mm256_srli_epi64(w15, 7));
+		__m256i s1 = _mm256_xor_si256(_mm256_xor_si256(ROTR64x4(w[k - 1], 19), ROTR64x4(w[k - 1], 61)), _mm256_srli_epi64(w[k - 1], 6));
+		w[k] = _mm256_add_epi64(_mm256_add_epi64(w[k - 8], s0), _mm256_add_epi64(w7, s1));
+	}
+	for (int k = 0; k < 40; k++)
+	{
+		__m256i kw = _mm256_add_epi64(w[k], _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(K512 + k * 2))));
+		_mm_storeu_si128((__m128i *)(wk0 + k * 2), _mm256_castsi256_si128(kw));
+		_mm_storeu_si128((__m128i *)(wk1 + k * 2), _mm256_extracti128_si256(kw, 1));
+	}
+}
+
+__attribute__((target("avx2"))) void sha512_avx2_transform(uint64_t *state, const void *data, uint32_t numBlocks)
+{
+	const uint8_t *p = (const uint8_t *)data;
+	uint64_t wk[2][80];
+	for (uint32_t i = 0; i < numBlocks; i += 2, p += 2 * SHA512_BLOCK_SIZE)
+	{
+		// an odd last block is scheduled twice
+		bool pair = i + 1 < numBlocks;
+		sha512_schedule_x2(p, pair ? p + SHA512_BLOCK_SIZE : p, wk[0], wk[1]);
+		sha512_rounds_wk(state, wk[0]);
+		if (pair)
+			sha512_rounds_wk(state, wk[1]);
+	}
+}
+
+// Same contract as the SHA-256 lane kernels: lane l compresses min(n, nblocks[l]) blocks from data[l]
+__attribute__((target("avx2"))) void sha512_x4_avx2(uint64_t *state, const uint8_t *const *data, const uint64_t *nblocks, uint64_t n)
+{
+	const __m256i flip = _mm256_setr_epi8(
+		7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+		7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+	__m256i s[8];
+	for (int j = 0; j < 8; j++)
+		s[j] = _mm256_loadu_si256((const __m256i *)(state + j * 4));
+
+	for (uint64_t it = 0; it < n; it++)
+	{
+		const uint8_t *p[4];
+		int64_t active[4];
+		for (int l = 0; l < 4; l++)
+		{
+			active[l] = it < nblocks[l] ? -1 : 0;
+			p[l] = active[l] ? data[l] + it * SHA512_BLOCK_SIZE : zero_block;
+		}
+		__m256i mask = _mm256_loadu_si256((const __m256i *)active);
+
+		// load 4 words of 4 lanes at a time and transpose them so that w[j] holds word j of every lane
+		__m256i w[16];
+		for (int q = 0; q < 4; q++)
+		{
+			__m256i r[4];
+			for (int l = 0; l < 4; l++)
+				r[l] = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(p[l] + q * 32)), flip);
+			__m256i t0 = _mm256_unpacklo_epi64(r[0], r[1]);
+			__m256i t1 = _mm256_unpackhi_epi64(r[0], r[1]);
+			__m256i t2 = _mm256_unpacklo_epi64(r[2], r[3]);
+			__m256i t3 = _mm256_unpackhi_epi64(r[2], r[3]);
+			w[q * 4 + 0] = _mm256_permute2x128_si256(t0, t2, 0x20);
+			w[q * 4 + 1] = _mm256_permute2x128_si256(t1, t3, 0x20);
+			w[q * 4 + 2] = _mm256_permute2x128_si256(t0, t2, 0x31);
+			w[q * 4 + 3] = _mm256_permute2x128_si256(t1, t3, 0x31);
+		}
+
+		__m256i a = s[0], b = s[1], c = s[2], d = s[3];
+		__m256i e = s[4], f = s[5], g = s[6], h = s[7];
+		for (int i = 0; i < 80; i++)
+		{
+			__m256i wi;
+			if (i < 16)
+				wi = w[i];
+			else
+			{
+				__m256i w15 = w[(i - 15) & 15], w2 = w[(i - 2) & 15];
+				__m256i s0 = _mm256_xor_si256(_mm256_xor_si256(ROTR64x4(w15, 1), ROTR64x4(w15, 8)), _mm256_srli_epi64(w15, 7));
+				__m256i s1 = _mm256_xor_si256(_mm256_xor_si256(ROTR64x4(w2, 19), ROTR64x4(w2, 61)), _mm256_srli_epi64(w2, 6));
+				wi = _mm256_add_epi64(_mm256_add_epi64(w[i & 15], s0), _mm256_add_epi64(w[(i - 7) & 15], s1));
+				w[i & 15] = wi;
+			}
+			__m256i kw = _mm256_add_epi64(wi, _mm256_set1_epi64x(K512[i]));
+			__m256i S1 = _mm256_xor_si256(_mm256_xor_si256(ROTR64x4(e, 14), ROTR64x4(e, 18)), ROTR64x4(e, 41));
+			__m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+			__m256i temp1 = _mm256_add_epi64(_mm256_add_epi64(h, S1), _mm256_add_epi64(ch, kw));
+			__m256i S0 = _mm256_xor_si256(_mm256_xor_si256(ROTR64x4(a, 28), ROTR64x4(a, 34)), ROTR64x4(a, 39));
+			__m256i maj = _mm256_xor_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_xor_si256(a, b)));
+			__m256i temp2 = _mm256_add_epi64(S0, maj);
+			h = g;
+			g = f;
+			f = e;
+			e = _mm256_add_epi64(d, temp1);
+			d = c;
+			c = b;
+			b = a;
+			a = _mm256_add_epi64(temp1, temp2);
+		}
+		__m256i x[8] = {a, b, c, d, e, f, g, h};
+		for (int j = 0; j < 8; j++)
+			s[j] = _mm256_blendv_epi8(s[j], _mm256_add_epi64(s[j], x[j]), mask);
+	}
+
+	for (int j = 0; j < 8; j++)
+		_mm256_storeu_si256((__m256i *)(state + j * 4), s[j]);
+}
+
+// The lane scheduler of the SHA-256 kernels with 64-bit words and 128-byte blocks; iv is H512 or H384
+void sha512_mb_avx2(const uint64_t iv[8], const uint8_t *const *msgs, const uint64_t *lens, uint64_t (*digests)[8], size_t count)
+{
+	mb_hash<uint64_t, SHA512_LANES_AVX2>(sha512_x4_avx2, iv, msgs, lens, digests, count);
+}
+
+void sha512_generic_transform(uint64_t *state, const void *data, uint32_t numBlocks)
+{
+	const uint8_t *block = (const uint8_t *)data;
+	for (uint32_t i = 0; i < numBlocks; i++, block += SHA512_BLOCK_SIZE)
+		sha512_compress(state, block);
+}
+
+// Multi-buffer fallback, one message after another through the dispatched transform
+void sha512_mb_serial(const uint64_t iv[8], const uint8_t *const *msgs, const uint64_t *lens, uint64_t (*digests)[8], size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		SHA512 sha512;
+		memcpy(sha512.state, iv, sizeof(sha512.state));
+		sha512.update(msgs[i], lens[i]);
+		sha512.final();
+		memcpy(digests[i], sha512.state, sizeof(sha512.state));
+	}
+}
@@ -0,0 +1,205 @@
+#ifndef _SHA512_H
+#define _SHA512_H
+
+#include "sha256.h"
+
+// SHA-512 and SHA-384: 64-bit words, 128-byte blocks, 80 rounds. SHA-384 is SHA-512 with its own
+// initial state and the digest cut to 48 bytes.
+
+const int SHA512_BLOCK_SIZE = 128;
+const int SHA512_DIGEST_SIZE = 64;
+const int SHA384_DIGEST_SIZE = 48;
+const uint64_t K512[80] = {
+	0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL,
+	0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+	0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL,
+	0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+	0xd807aa98a3030242ULL, 0x12835b0145706fbeULL,
+	0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+	0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL,
+	0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+	0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL,
+	0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+	0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL,
+	0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+	0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL,
+	0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+	0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL,
+	0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+	0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL,
+	0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+	0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL,
+	0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+	0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL,
+	0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+	0xd192e819d6ef5218ULL, 0xd69906245565a910ULL,
+	0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+	0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL,
+	0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+	0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL,
+	0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+	0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL,
+	0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+	0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL,
+	0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+	0xca273eceea26619cULL, 0xd186b8c721c0c207ULL,
+	0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+	0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL,
+	0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+	0x28db77f523047d84ULL, 0x32caab7b40c72493ULL,
+	0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+	0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL,
+	0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL};
+const uint64_t H512[8] = {
+	0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL,
+	0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+	0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+	0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL};
+const uint64_t H384[8] = {
+	0xcbbb9d5dc1059ed8ULL, 0x629a292a367cd507ULL,
+	0x9159015a3070dd17ULL, 0x152fecd8f70e5939ULL,
+	0x67332667ffc00b31ULL, 0x8eb44a8768581511ULL,
+	0xdb0c2e0d64f98fa7ULL, 0x47b5481dbefa4fa4ULL};
+#define ROTR64(x, n) ((x >> n) | (x << (64 - n)))
+
+// One block of the generic compression function
+static inline void sha512_compress(uint64_t *state, const uint8_t *block)
+{
+	uint64_t w[80];
+	for (int i = 0; i < 16; i++)
+	{
+		w[i] = 0;
+		for (int j = 0; j < 8; j++)
+			w[i] = (w[i] << 8) | block[i * 8 + j];
+	}
+	for (int i = 16; i < 80; i++)
+	{
+		uint64_t s0 = ROTR64(w[i - 15], 1) ^ ROTR64(w[i - 15], 8) ^ (w[i - 15] >> 7);
+		uint64_t s1 = ROTR64(w[i - 2], 19) ^ ROTR64(w[i - 2], 61) ^ (w[i - 2] >> 6);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+	uint64_t a = state[0], b = state[1], c = state[2], d = state[3];
+	uint64_t e = state[4], f = state[5], g = state[6], h = state[7];
+	for (int i = 0; i < 80; i++)
+	{
+		uint64_t S1 = ROTR64(e, 14) ^ ROTR64(e, 18) ^ ROTR64(e, 41);
+		uint64_t ch = (e & f) ^ ((~e) & g);
+		uint64_t temp1 = h + S1 + ch + K512[i] + w[i];
+		uint64_t S0 = ROTR64(a, 28) ^ ROTR64(a, 34) ^ ROTR64(a, 39);
+		uint64_t maj = (a & b) ^ (a & c) ^ (b & c);
+		uint64_t temp2 = S0 + maj;
+		h = g;
+		g = f;
+		f = e;
+		e = d + temp1;
+		d = c;
+		c = b;
+		b = a;
+		a = temp1 + temp2;
+	}
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+	state[5] += f;
+	state[6] += g;
+	state[7] += h;
+}
+
+// Runtime dispatch, next to the SHA-256 one in sha256_dispatch.cpp.
+// SHA512_BACKEND (generic, avx2) and SHA512_MB_BACKEND (serial, avx2) force a backend.
+typedef void (*sha512_transform_fn)(uint64_t *state, const void *data, uint32_t numBlocks);
+typedef void (*sha512_mb_fn)(const uint64_t iv[8], const uint8_t *const *msgs, const uint64_t *lens, uint64_t (*digests)[8], size_t count);
+extern sha512_transform_fn sha512_transform;
+extern sha512_mb_fn sha512_mb_hash;
+extern const char *sha512_transform_name;
+extern const char *sha512_mb_name;
+void sha512_generic_transform(uint64_t *state, const void *data, uint32_t numBlocks);
+// The message schedule of two blocks at a time in the two halves of a ymm register, with K512 pre-added
+void sha512_avx2_transform(uint64_t *state, const void *data, uint32_t numBlocks);
+
+struct SHA512
+{
+	uint64_t state[8];
+	uint8_t buffer[SHA512_BLOCK_SIZE]; // partial block of the stream, totalBytes % SHA512_BLOCK_SIZE bytes used
+	uint64_t totalBytes;               // bytes passed to update() so far
+	int digestSize;                    // SHA512_DIGEST_SIZE, or SHA384_DIGEST_SIZE for SHA-384
+
+	SHA512(int digestSize = SHA512_DIGEST_SIZE) : digestSize(digestSize)
+	{
+		totalBytes = 0;
+		memcpy(state, digestSize == SHA384_DIGEST_SIZE ? H384 : H512, sizeof(state));
+	}
+
+	void processBlocks(const uint8_t *data, uint32_t n)
+	{
+		sha512_transform(state, data, n);
+	}
+
+	// Same streaming contract as SHA256::update()/final()
+	void update(const uint8_t *data, uint64_t len)
+	{
+		uint64_t used = totalBytes % SHA512_BLOCK_SIZE;
+		totalBytes += len;
+		if (used)
+		{
+			uint64_t fill = SHA512_BLOCK_SIZE - used < len ? SHA512_BLOCK_SIZE - used : len;
+			memcpy(buffer + used, data, fill);
+			data += fill;
+			len -= fill;
+			if (used + fill < SHA512_BLOCK_SIZE)
+				return;
+			processBlocks(buffer, 1);
+		}
+		uint64_t blocks = len / SHA512_BLOCK_SIZE;
+		while (blocks)
+		{
+			uint32_t n = blocks < (1u << 30) ? blocks : (1u << 30);
+			processBlocks(data, n);
+			data += (uint64_t)n * SHA512_BLOCK_SIZE;
+			blocks -= n;
+		}
+		memcpy(buffer, data, len % SHA512_BLOCK_SIZE);
+	}
+
+	// The length field is 128 bits; its upper half only holds the bits shifted out of totalBytes * 8
+	void final()
+	{
+		uint64_t used = totalBytes % SHA512_BLOCK_SIZE;
+		buffer[used++] = 0x80;
+		if (used > SHA512_BLOCK_SIZE - 16)
+		{
+			memset(buffer + used, 0, SHA512_BLOCK_SIZE - used);
+			processBlocks(buffer, 1);
+			used = 0;
+		}
+		memset(buffer + used, 0, SHA512_BLOCK_SIZE - 16 - used);
+		uint64_t bitLen[2] = {totalBytes >> 61, totalBytes << 3};
+		for (int i = 0; i < 16; i++)
+			buffer[SHA512_BLOCK_SIZE - 16 + i] = (bitLen[i / 8] >> ((7 - i % 8) * 8)) & 0xFF;
+		processBlocks(buffer, 1);
+	}
+
+	// Big-endian digest bytes, digestSize of them
+	void digest(uint8_t *out) const
+	{
+		for (int i = 0; i < digestSize; i++)
+			out[i] = state[i / 8] >> ((7 - i % 8) * 8);
+	}
+};
+
+struct SHA384 : SHA512
+{
+	SHA384() : SHA512(SHA384_DIGEST_SIZE) {}
+};
+
+// Multi-buffer (sha512.cpp): 4 messages per ymm register, state word-major as in the SHA-256 kernels
+const int SHA512_LANES_AVX2 = 4;
+void sha512_x4_avx2(uint64_t *state, const uint8_t *const *data, const uint64_t *nblocks, uint64_t n);
+// SHA-512 (iv = H512) or SHA-384 (iv = H384) of count independent messages; digests[i] receives the
+// final state words of msgs[i], of which SHA-384 keeps the first six
+void sha512_mb_avx2(const uint64_t iv[8], const uint8_t *const *msgs, const uint64_t *lens, uint64_t (*digests)[8], size_t count);
+void sha512_mb_serial(const uint64_t iv[8], const uint8_t *const *msgs, const uint64_t *lens, uint64_t (*digests)[8], size_t count);
+
+#endif